@@ -1,12 +1,22 @@
 struct buf {
   int flags;
   uint dev;
-  uint sector;
-  struct buf *prev; // LRU cache list
+  uint sector;       // block number
+  struct sleeplock lock;
+  uint refcnt;
+  int used;          // referenced since the last CLOCK sweep
+  struct buf *hnext; // hash bucket chain
+  struct buf *prev;  // CLOCK ring
   struct buf *next;
   struct buf *qnext; // disk queue
-  uchar data[512];
+  struct buf *qprev;
+  int qheap;         // I/O scheduler heap and index in it
+  int qidx;
+  uint qtime;        // ticks when queued
+  uint64 qtsc;       // rdtsc when queued
+  void (*iodone)(struct buf*); // called when the disk is done, or 0
+  uchar *data;       // BSIZE bytes
 };
-#define B_BUSY  0x1  // buffer is locked by some process
 #define B_VALID 0x2  // buffer has been read from disk
 #define B_DIRTY 0x4  // buffer needs to be written to disk
+#define B_RA    0x8  // read ahead and not yet used
@@ -2,17 +2,37 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct ioqueue;
+struct iovec;
+struct page;
+struct pcidev;
 struct pipe;
 struct proc;
+struct rwsleeplock;
+struct sleeplock;
 struct spinlock;
 struct stat;
+struct statfs;
 struct superblock;
 
 // bio.c
+void            bcachedump(void);
+void            bdone(struct buf*);
 void            binit(void);
+struct buf*     bfresh(uint, uint);
+void            bflush(uint);
+void            bpin(struct buf*);
+void            bprefetch(uint, uint*, int);
 struct buf*     bread(uint, uint);
+struct buf*     breadasync(uint, uint);
+void            breadn(uint, uint*, int, struct buf**);
+char*           breclaim(void);
 void            brelse(struct buf*);
+void            bunpin(struct buf*);
+void            bwait(struct buf*);
 void            bwrite(struct buf*);
+void            bwriteasync(struct buf*);
+void            bwriten(struct buf**, int);
 
 // console.c
 void            consoleinit(void);
@@ -26,20 +46,33 @@ int             exec(char*, char**);
 // file.c
 struct file*    filealloc(void);
 void            fileclose(struct file*);
+int             filectl(struct file*, int, int);
 struct file*    filedup(struct file*);
 void            fileinit(void);
+int             filepread(struct file*, char*, int n, uint off);
+int             filepwrite(struct file*, char*, int n, uint off);
 int             fileread(struct file*, char*, int n);
+int             filereadv(struct file*, struct iovec*, int);
+int             fileseek(struct file*, int, int);
+int             filesend(struct file*, struct file*, int);
 int             filestat(struct file*, struct stat*);
+int             filesync(struct file*);
 int             filewrite(struct file*, char*, int n);
+int             filewritev(struct file*, struct iovec*, int);
 
 // fs.c
 void            readsb(int dev, struct superblock *sb);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
+void            dirunlink(struct inode*, uint);
+void            fsinit(int);
+void            fsstat(uint, struct statfs*);
 struct inode*   ialloc(uint, short);
+struct buf*     ibread(struct inode*, uint);
 struct inode*   idup(struct inode*);
 void            iinit(void);
 void            ilock(struct inode*);
+void            ilockshared(struct inode*);
 void            iput(struct inode*);
 void            iunlock(struct inode*);
 void            iunlockput(struct inode*);
@@ -52,18 +85,33 @@ void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, char*, uint, uint);
 
 // ide.c
+void            ideawait(struct buf*);
+void            idedump(void);
 void            ideinit(void);
 void            ideintr(void);
+extern int      ideirq;
 void            iderw(struct buf*);
+void            idesubmit(struct buf**, int);
 
 // ioapic.c
 void            ioapicenable(int irq, int cpu);
+void            ioapicenablepci(int irq, int cpu);
 extern uchar    ioapicid;
 void            ioapicinit(void);
 
+// iosched.c
+void            ioqadd(struct ioqueue*, struct buf*);
+void            ioqdone(struct ioqueue*, struct buf*);
+void            ioqdump(struct ioqueue*);
+int             ioqfull(struct ioqueue*);
+void            ioqinit(struct ioqueue*, char*);
+struct buf*     ioqmerge(struct ioqueue*, struct buf*);
+struct buf*     ioqnext(struct ioqueue*);
+
 // kalloc.c
 char*           kalloc(void);
 void            kfree(char*);
+int             kfreepages(void);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
 
@@ -80,6 +128,8 @@ void            microdelay(int);
 
 // log.c
 void            initlog(void);
+void            log_data(struct buf*);
+void            log_sync(void);
 void            log_write(struct buf*);
 void            begin_trans();
 void            commit_trans();
@@ -90,6 +140,21 @@ int             mpbcpu(void);
 void            mpinit(void);
 void            mpstartthem(void);
 
+// pcache.c
+void            pcachedump(void);
+void            pcacheinit(void);
+struct page*    pget(uint, uint, uint);
+void            pinval(uint, uint);
+struct page*    plookup(uint, uint, uint);
+void            pput(struct page*);
+char*           preclaim(void);
+
+// pci.c
+void            pcienable(struct pcidev*);
+int             pcifind(int, int, int, int, struct pcidev*);
+uint            pciread(struct pcidev*, uint);
+void            pciwrite(struct pcidev*, uint, uint);
+
 // picirq.c
 void            picenable(int);
 void            picinit(void);
@@ -97,7 +162,11 @@ void            picinit(void);
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
+int             pipeput(struct pipe*, char*, int);
 int             piperead(struct pipe*, char*, int);
+int             piperesize(struct pipe*, int);
+int             pipesize(struct pipe*);
+int             pipewaitspace(struct pipe*);
 int             pipewrite(struct pipe*, char*, int);
 
 //PAGEBREAK: 16
@@ -107,6 +176,7 @@ void            exit(void);
 int             fork(void);
 int             growproc(int);
 int             kill(int);
+int             kthread(char*, void(*)(void));
 void            pinit(void);
 void            procdump(void);
 void            scheduler(void) __attribute__((noreturn));
@@ -117,6 +187,19 @@ int             wait(void);
 void            wakeup(void*);
 void            yield(void);
 
+// sleeplock.c
+void            acquiresleep(struct sleeplock*);
+void            releasesleep(struct sleeplock*);
+int             holdingsleep(struct sleeplock*);
+void            initsleeplock(struct sleeplock*, char*);
+void            acquireread(struct rwsleeplock*);
+void            acquirewrite(struct rwsleeplock*);
+void            downgradewrite(struct rwsleeplock*);
+int             holdingrw(struct rwsleeplock*);
+int             holdingwrite(struct rwsleeplock*);
+void            initrwsleeplock(struct rwsleeplock*, char*);
+void            releaserw(struct rwsleeplock*);
+
 // swtch.S
 void            swtch(struct context**, struct context*);
 
@@ -126,6 +209,7 @@ void            getcallerpcs(void*, uint64*);
 void            getstackpcs(uint64*, uint64*);
 int             holding(struct spinlock*);
 void            initlock(struct spinlock*, char*);
+void            lockdump(void);
 void            release(struct spinlock*);
 void            pushcli(void);
 void            popcli(void);
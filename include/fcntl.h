@@ -2,3 +2,18 @@
 #define O_WRONLY  0x001
 #define O_RDWR    0x002
 #define O_CREATE  0x200
+
+// lseek whence values
+#define SEEK_SET  0   // offset is absolute
+#define SEEK_CUR  1   // offset is relative to current offset
+#define SEEK_END  2   // offset is relative to end of file
+
+// fcntl commands
+#define F_GETPIPE_SZ 1  // return size of a pipe's buffer
+#define F_SETPIPE_SZ 2  // resize a pipe's buffer to at least arg bytes
+
+// One buffer of a readv/writev request.
+struct iovec {
+  void *base;  // start of buffer
+  int len;     // length of buffer in bytes
+};
@@ -14,16 +14,26 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
-  int flags;          // I_BUSY, I_VALID
+  uint ranext;        // readahead: block expected next
+  uint raend;         // readahead: first block not yet requested
+  uint rawin;         // readahead: window, in blocks
+  struct spinlock maplock; // protects the mapping cache:
+  uint mapbn;         // blocks mapbn..mapbn+maplen-1 are at
+  uint mapaddr;       //   disk blocks mapaddr..
+  uint maplen;
+  uint leaf;          // indirect block mapping blocks from
+  uint leafbn;        //   leafbn, or 0
+  struct rwsleeplock lock; // protects everything below here
+  int flags;          // I_VALID
 
   short type;         // copy of disk inode
   short major;
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint index;
+  uint addrs[NDIRECT+3];
 };
-#define I_BUSY 0x1
 #define I_VALID 0x2
 
 // table mapping major device number to
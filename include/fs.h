@@ -9,7 +9,10 @@
 // Then sb.nlog log blocks.
 
 #define ROOTINO 1  // root i-number
-#define BSIZE 512  // block size
+#ifndef BSIZE
+#define BSIZE 4096  // block size: 512 times a power of 2, at most PGSIZE
+#endif
+#define BSECT (BSIZE / 512)  // disk sectors per block
 
 // File system super block
 struct superblock {
@@ -17,11 +20,14 @@ struct superblock {
   uint nblocks;      // Number of data blocks
   uint ninodes;      // Number of inodes.
   uint nlog;         // Number of log blocks
+  uint bsize;        // Block size (bytes)
 };
 
-#define NDIRECT 12
+#define NDIRECT 9
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define NTINDIRECT (NDINDIRECT * NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT + NTINDIRECT)
 
 // On-disk inode structure
 struct dinode {
@@ -30,7 +36,10 @@ struct dinode {
   short minor;          // Minor device number (T_DEV only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint index;           // Directory index block (T_DIR only), 0,
+                        //   or DIRNOINDEX
+  uint addrs[NDIRECT+3];   // Data block addresses, then indirect,
+                           // double and triple indirect blocks
 };
 
 // Inodes per block.
@@ -52,3 +61,32 @@ struct dirent {
   ushort inum;
   char name[DIRSIZ];
 };
+
+// A directory bigger than one block also has a hash index:
+// a header block listing buckets, each a chain of blocks
+// holding the hash and slot (offset / sizeof(struct dirent))
+// of some entries.  Entry hashes pick buckets by linear
+// hashing.  A directory whose index was given up has index
+// DIRNOINDEX, the super block, which no index can use.
+#define DIRNOINDEX 1
+
+struct dirhent {
+  uint hash;
+  uint slot;
+};
+
+#define NDIRHENT ((BSIZE - 2*sizeof(uint)) / sizeof(struct dirhent))
+#define NDIRBUCKET (BSIZE / sizeof(uint) - 3)
+
+struct dirbucket {
+  uint n;                         // entries in use
+  uint next;                      // next block in chain, or 0
+  struct dirhent e[NDIRHENT];
+};
+
+struct dirindex {
+  uint nbucket;                   // buckets in use
+  uint nentry;                    // entries indexed
+  uint freeslot;                  // no free dirent below this
+  uint bucket[NDIRBUCKET];        // bucket block addresses
+};
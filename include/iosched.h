@@ -0,0 +1,35 @@
+// Disk request queue, ordered by a pluggable I/O scheduler.
+// The driver adds requests with ioqadd, and when the disk is
+// idle takes the next one with ioqnext and requests that
+// continue it with ioqmerge.  The driver's lock protects it.
+
+#define NIOQ   256  // most requests queued per disk queue
+#define NIOHIST 16  // histogram buckets, by powers of two
+
+struct ioqueue;
+
+struct iosched {
+  char *name;
+  struct buf *(*next)(struct ioqueue*);  // remove next request
+};
+
+struct ioqueue {
+  struct iosched *sched;
+  int n;               // requests queued
+  uint64 pos;          // key of the sector after the last started
+
+  // C-LOOK: a min-heap of requests at or after pos, for the
+  // current sweep, and one of those before, for the next.
+  struct buf *heap[2][NIOQ];
+  int nheap[2];
+  int cur;             // heap[cur] is the current sweep
+
+  // deadline: requests in arrival order, reads and writes,
+  // through qprev/qnext.
+  struct buf *fifo[2];
+  struct buf *fifotail[2];
+
+  // Statistics.
+  uint64 depth[NIOHIST];    // queue depth seen by ioqadd
+  uint64 latency[NIOHIST];  // ioqadd to ioqdone, in 1024-cycle units
+};
@@ -3,9 +3,15 @@
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
-#define NBUF         10  // size of disk block cache
+#define NBUF        128  // initial size of disk block cache
+#define NPCACHE      64  // size of file page cache, in pages
 #define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
-#define LOGSIZE      10  // max data sectors in on-disk log
+#define MAXIOV       16  // max buffers per readv/writev
+#define IOSCHED "deadline"  // disk I/O scheduler: clook or deadline
+#define MAXOPBLOCKS  64  // max # of blocks any FS op writes
+#define LOGSIZE    1024  // max data sectors in a log transaction
+#define WRITEBACK     1  // 1: ordered-data write-back, 0: commit every call
+#define FLUSHTICKS  100  // ticks between write-back commits
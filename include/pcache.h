@@ -0,0 +1,13 @@
+// A page of file data in the page cache.
+struct page {
+  uint dev;          // -1 if holding no page
+  uint inum;
+  uint pgno;         // file offset / PGSIZE
+  int valid;         // data has been read from the file
+  int refcnt;
+  struct sleeplock lock;
+  char *data;        // PGSIZE bytes, or 0
+  struct page *hnext; // hash chain
+  struct page *prev; // LRU list
+  struct page *next;
+};
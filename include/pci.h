@@ -0,0 +1,14 @@
+// PCI devices, as found by pcifind.
+struct pcidev {
+  uint bus;
+  uint dev;
+  uint func;
+  ushort vendor;
+  ushort device;
+  uchar class;
+  uchar subclass;
+  uchar irq;         // interrupt line
+  uint bar[6];       // base address registers
+};
+
+#define PCI_BAR_IO  0x1  // bar is an I/O port base
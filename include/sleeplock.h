@@ -0,0 +1,23 @@
+// Long-term locks for processes
+struct sleeplock {
+  uint locked;       // Is the lock held?
+  struct spinlock lk; // spinlock protecting this sleep lock
+
+  // For debugging:
+  char *name;        // Name of lock.
+  int pid;           // Process holding lock
+};
+
+// Reader-writer lock for processes: any number of shared
+// holders, or a single exclusive holder.  New shared holders
+// wait while a writer is queued, so writers are not starved.
+struct rwsleeplock {
+  struct spinlock lk; // spinlock protecting this lock
+  int readers;       // Number of shared holders
+  int writer;        // Is the lock held exclusively?
+  int wwait;         // Number of processes waiting to write
+
+  // For debugging:
+  char *name;        // Name of lock.
+  int pid;           // Process holding lock exclusively
+};
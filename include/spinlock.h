@@ -1,10 +1,21 @@
 // Mutual exclusion lock.
+// A ticket lock: acquire takes the next ticket and spins until
+// owner reaches it, so waiters are served in FIFO order.
 struct spinlock {
-  uint locked;       // Is the lock held?
+  uint next;             // Next ticket to hand out
+  volatile uint owner;   // Ticket now holding the lock
+                         // (lock is free when owner == next)
 
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
   uint64 pcs[10];      // The call stack (an array of program counters)
                      // that locked the lock.
+
+  // Contention statistics, only updated by the holder.
+  uint64 nacquire;   // Number of acquisitions
+  uint64 ncontend;   // Acquisitions that had to wait
+  uint64 spin;       // Cycles spent waiting
+  uint64 holdmax;    // Longest hold in cycles
+  uint64 tacquire;   // Cycle counter when last acquired
 };
@@ -9,3 +9,11 @@ struct stat {
   short nlink; // Number of links to file
   uint size;   // Size of file in bytes
 };
+
+struct statfs {
+  uint bsize;   // Block size in bytes
+  uint blocks;  // Data blocks
+  uint bfree;   // Free data blocks
+  uint files;   // Inodes
+  uint ffree;   // Free inodes
+};
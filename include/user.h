@@ -1,4 +1,6 @@
 struct stat;
+struct statfs;
+struct iovec;
 
 // system calls
 int fork(void);
@@ -22,6 +24,17 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int readv(int, struct iovec*, int);
+int writev(int, struct iovec*, int);
+int pread(int, void*, int, int);
+int pwrite(int, void*, int, int);
+int lseek(int, int, int);
+int sendfile(int, int, int);
+int splice(int, int, int);
+int fcntl(int, int, int);
+int fsync(int);
+int sync(void);
+int statfs(char*, struct statfs*);
 
 // ulib.c
 int stat(char*, struct stat*);
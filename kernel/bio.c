@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -13,126 +13,705 @@
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
 //
-// The implementation uses three state flags internally:
-// * B_BUSY: the block has been returned from bread
-//     and has not been passed back to brelse.
+// Each buffer has a sleep lock, held from bread until brelse,
+// and a reference count of the processes holding or waiting
+// for that lock; a buffer is only recycled when refcnt is 0.
+// The implementation uses two state flags internally:
 // * B_VALID: the buffer data has been read from the disk.
 // * B_DIRTY: the buffer data has been modified
 //     and needs to be written to disk.
+//
+// Buffers are found by hashing (dev, sector) into one of
+// NBUCKET chains, each with its own lock, so hits on blocks
+// in different buckets do not contend.  A bucket lock guards
+// its chain and the refcnt and used bits of the buffers on it.
+// Replacement is a CLOCK sweep over a ring of all buffers:
+// brelse sets used, and the sweep gives used buffers a second
+// chance.  bcache.lock serializes misses, so only one process
+// at a time moves buffers between buckets; it is taken before
+// any bucket lock and is the only way to hold two of them.
+//
+// The cache starts with the NBUF static buffers and grows
+// BPERPAGE buffers at a time while free memory lasts: a page
+// of buffer headers plus the pages for their data.  When
+// kalloc runs out of pages it calls breclaim, which frees a
+// group whose buffers are all idle and clean.  Buffers not
+// holding any block have dev == -1 and are on no chain.
 
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "mmu.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "buf.h"
+#include "fs.h"
 
-struct {
+#define NBUCKET 61
+#define BHASH(dev, sector) (((dev)*31 + (sector)) % NBUCKET)
+#define BRESERVE 256  // free pages the cache leaves to others
+#define NBATCH 16     // most disk requests submitted at once
+
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct buf *head;  // chain through hnext
+  uint64 hits;
+};
+
+#define BPERPAGE 16  // buffers added by each bgrow
+#define BDPAGES ((BPERPAGE*BSIZE + PGSIZE-1) / PGSIZE)
 
-  // Linked list of all buffers, through prev/next.
-  // head.next is most recently used.
-  struct buf head;
+// Buffers added to the cache by bgrow: a page of headers,
+// and the pages holding their data.
+struct bpage {
+  struct bpage *next;
+  char *data[BDPAGES];
+  struct buf buf[BPERPAGE];
+};
+
+struct {
+  struct spinlock lock;  // serializes recycling, growing, shrinking
+  struct buf buf[NBUF];
+  uchar data[NBUF][BSIZE] __attribute__((aligned(BSIZE)));
+  struct buf *hand;      // CLOCK hand, in the ring through prev/next
+  struct bpage *pages;   // pages added by bgrow
+  int nbuf;              // buffers in the ring
+  int nempty;            // of which hold no block
+  int nwait;             // processes sleeping for a buffer
+  uint64 misses;
+  uint64 evictions;
+  uint64 grows;
+  uint64 shrinks;
+  uint64 raissued;       // readahead reads started
+  uint64 rahits;         // of which were later read
+  uint64 rawasted;       // of which were evicted unread
+  struct bucket bucket[NBUCKET];
 } bcache;
 
+// Add an empty buffer, with BSIZE bytes at data,
+// to the ring behind the hand.
+// Caller must hold bcache.lock.
+static void
+badd(struct buf *b, uchar *data)
+{
+  b->data = data;
+  b->dev = -1;
+  b->sector = 0;
+  b->flags = 0;
+  b->refcnt = 0;
+  b->used = 0;
+  b->iodone = 0;
+  b->hnext = 0;
+  initsleeplock(&b->lock, "buffer");
+  if(bcache.hand == 0){
+    b->next = b->prev = b;
+    bcache.hand = b;
+  } else {
+    b->next = bcache.hand;
+    b->prev = bcache.hand->prev;
+    b->prev->next = b;
+    bcache.hand->prev = b;
+  }
+  bcache.nbuf++;
+  bcache.nempty++;
+}
+
 void
 binit(void)
 {
-  struct buf *b;
+  struct bucket *bk;
+  int i;
 
+  if(sizeof(struct bpage) > PGSIZE)
+    panic("binit: struct bpage too big");
   initlock(&bcache.lock, "bcache");
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++)
+    initlock(&bk->lock, "bcache.bucket");
 
 //PAGEBREAK!
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    b->dev = -1;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+  for(i = 0; i < NBUF; i++)
+    badd(&bcache.buf[i], bcache.data[i]);
+}
+
+// Grow the cache by BPERPAGE buffers, if memory allows.
+// Called without locks, since kalloc may call breclaim.
+static void
+bgrow(void)
+{
+  struct bpage *pg;
+  int i;
+
+  if(kfreepages() <= BRESERVE + BDPAGES || (pg = (struct bpage*)kalloc()) == 0)
+    return;
+  for(i = 0; i < BDPAGES; i++){
+    if((pg->data[i] = kalloc()) == 0){
+      while(--i >= 0)
+        kfree(pg->data[i]);
+      kfree((char*)pg);
+      return;
+    }
+  }
+  acquire(&bcache.lock);
+  pg->next = bcache.pages;
+  bcache.pages = pg;
+  for(i = 0; i < BPERPAGE; i++)
+    badd(&pg->buf[i], (uchar*)pg->data[i*BSIZE/PGSIZE] + i*BSIZE%PGSIZE);
+  bcache.grows++;
+  if(bcache.nwait)
+    wakeup(&bcache);
+  release(&bcache.lock);
+}
+
+// Drop the block cached in b, if b is idle and clean.
+// Caller must hold bcache.lock.  Returns 0 if b is busy.
+static int
+bdrop(struct buf *b)
+{
+  struct bucket *bk;
+  struct buf **pp;
+
+  if(b->dev == -1)
+    return b->refcnt == 0;
+  bk = &bcache.bucket[BHASH(b->dev, b->sector)];
+  acquire(&bk->lock);
+  if(b->refcnt != 0 || (b->flags & B_DIRTY)){
+    release(&bk->lock);
+    return 0;
   }
+  for(pp = &bk->head; *pp != b; pp = &(*pp)->hnext)
+    if(*pp == 0)
+      panic("bdrop");
+  *pp = b->hnext;
+  b->hnext = 0;
+  b->dev = -1;
+  release(&bk->lock);
+  bcache.nempty++;
+  return 1;
+}
+
+// Give a group of idle, clean buffers back to kalloc:
+// free their data pages, and return their header page.
+// Called by kalloc when it has no free pages.
+// Returns the page, or 0 if no page could be freed.
+char*
+breclaim(void)
+{
+  struct bpage *pg, **pp;
+  struct buf *b;
+  int i, idle;
+
+  acquire(&bcache.lock);
+  for(pp = &bcache.pages; (pg = *pp) != 0; pp = &pg->next){
+    idle = 1;
+    for(i = 0; i < BPERPAGE; i++)
+      if(!bdrop(&pg->buf[i]))
+        idle = 0;
+    if(!idle)
+      continue;
+
+    // Unlink the buffers from the ring.
+    *pp = pg->next;
+    for(i = 0; i < BPERPAGE; i++){
+      b = &pg->buf[i];
+      if(bcache.hand == b)
+        bcache.hand = b->next;
+      b->prev->next = b->next;
+      b->next->prev = b->prev;
+    }
+    if(bcache.hand >= pg->buf && bcache.hand < pg->buf+BPERPAGE)
+      bcache.hand = bcache.buf;
+    bcache.nbuf -= BPERPAGE;
+    bcache.nempty -= BPERPAGE;
+    bcache.shrinks++;
+    release(&bcache.lock);
+    for(i = 0; i < BDPAGES; i++)
+      kfree(pg->data[i]);
+    return (char*)pg;
+  }
+  release(&bcache.lock);
+  return 0;
+}
+
+// Find sector on device dev in bucket bk.
+// Caller must hold bk->lock.
+static struct buf*
+blookup(struct bucket *bk, uint dev, uint sector)
+{
+  struct buf *b;
+
+  for(b = bk->head; b; b = b->hnext)
+    if(b->dev == dev && b->sector == sector)
+      return b;
+  return 0;
+}
+
+// Sweep the ring for a buffer to hold a block in bucket bk:
+// an empty one, or an idle, clean one not used lately.
+// Moves it onto bk's chain and returns it, or 0 if every
+// buffer is busy or dirty.  Caller must hold bcache.lock
+// and bk->lock.
+static struct buf*
+bvictim(struct bucket *bk)
+{
+  struct buf *b, **pp;
+  struct bucket *old;
+  int n;
+
+  for(n = 0; n < 2*bcache.nbuf; n++){
+    b = bcache.hand;
+    bcache.hand = b->next;
+    if(b->dev == -1){
+      bcache.nempty--;
+      old = 0;
+    } else {
+      old = &bcache.bucket[BHASH(b->dev, b->sector)];
+      if(old != bk)
+        acquire(&old->lock);
+      if(b->refcnt != 0 || (b->flags & B_DIRTY) || b->used){
+        if(b->refcnt == 0)
+          b->used = 0;
+        if(old != bk)
+          release(&old->lock);
+        continue;
+      }
+      if(b->flags & B_RA)
+        bcache.rawasted++;
+      for(pp = &old->head; *pp != b; pp = &(*pp)->hnext)
+        if(*pp == 0)
+          panic("bvictim");
+      *pp = b->hnext;
+      if(old != bk)
+        release(&old->lock);
+      bcache.evictions++;
+    }
+    b->hnext = bk->head;
+    bk->head = b;
+    return b;
+  }
+  return 0;
+}
+
+// Write back up to NBATCH idle dirty buffers, so that bget
+// can reuse them.  In write-back mode these hold file data
+// that would otherwise wait for bflush at the next commit,
+// which cannot happen while a transaction waits in bget.
+// Ordered mode lets data reach the disk before the metadata
+// that refers to it.  Caller must hold bcache.lock, which is
+// released during the writes.  Returns the number written.
+static int
+bclean(void)
+{
+  struct buf *b, *bs[NBATCH];
+  struct bucket *bk;
+  int i, n, m;
+
+  n = 0;
+  b = bcache.hand;
+  for(i = 0; i < bcache.nbuf && n < NBATCH; i++, b = b->next){
+    if(b->dev == -1 || !(b->flags & B_DIRTY))
+      continue;
+    bk = &bcache.bucket[BHASH(b->dev, b->sector)];
+    acquire(&bk->lock);
+    if(b->refcnt == 0 && (b->flags & B_DIRTY)){
+      b->refcnt++;
+      bs[n++] = b;
+    }
+    release(&bk->lock);
+  }
+  if(n == 0)
+    return 0;
+  release(&bcache.lock);
+
+  m = 0;
+  for(i = 0; i < n; i++){
+    acquiresleep(&bs[i]->lock);
+    if(bs[i]->flags & B_DIRTY)
+      bs[m++] = bs[i];
+    else
+      brelse(bs[i]);
+  }
+  if(m > 0)
+    bwriten(bs, m);
+  for(i = 0; i < m; i++){
+    bwait(bs[i]);
+    brelse(bs[i]);
+  }
+  acquire(&bcache.lock);
+  return n;
 }
 
 // Look through buffer cache for sector on device dev.
-// If not found, allocate fresh block.
-// In either case, return B_BUSY buffer.
+// If not found, allocate fresh block, growing the cache
+// if memory allows, else writing back idle dirty buffers
+// to reuse, and otherwise waiting for a buffer.
+// In either case, return locked buffer.
 static struct buf*
 bget(uint dev, uint sector)
 {
   struct buf *b;
+  struct bucket *bk;
 
-  acquire(&bcache.lock);
+  bk = &bcache.bucket[BHASH(dev, sector)];
 
- loop:
   // Is the sector already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->sector == sector){
-      if(!(b->flags & B_BUSY)){
-        b->flags |= B_BUSY;
-        release(&bcache.lock);
-        return b;
-      }
-      sleep(b, &bcache.lock);
-      goto loop;
-    }
+  acquire(&bk->lock);
+  if((b = blookup(bk, dev, sector)) != 0){
+    bk->hits++;
+    b->refcnt++;
+    release(&bk->lock);
+    acquiresleep(&b->lock);
+    return b;
   }
+  release(&bk->lock);
+
+  // Not cached.  Prefer growing to evicting.
+  if(bcache.nempty == 0)
+    bgrow();
 
-  // Not cached; recycle some non-busy and clean buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if((b->flags & B_BUSY) == 0 && (b->flags & B_DIRTY) == 0){
+  // Look again holding bcache.lock, in case another
+  // miss loaded it, then recycle a buffer.  Count as a
+  // waiter before scanning, so that a bunref racing with
+  // the scan sees nwait and does not skip the wakeup.
+  acquire(&bcache.lock);
+  bcache.nwait++;
+  for(;;){
+    acquire(&bk->lock);
+    if((b = blookup(bk, dev, sector)) != 0){
+      bk->hits++;
+      b->refcnt++;
+      break;
+    }
+    if((b = bvictim(bk)) != 0){
+      bcache.misses++;
       b->dev = dev;
       b->sector = sector;
-      b->flags = B_BUSY;
-      release(&bcache.lock);
-      return b;
+      b->flags = 0;
+      b->refcnt = 1;
+      b->used = 0;
+      break;
     }
+    release(&bk->lock);
+    if(bclean() == 0)
+      sleep(&bcache, &bcache.lock);
   }
-  panic("bget: no buffers");
+  bcache.nwait--;
+  release(&bk->lock);
+  release(&bcache.lock);
+  acquiresleep(&b->lock);
+  return b;
 }
 
-// Return a B_BUSY buf with the contents of the indicated disk sector.
+// Return a locked buf with the contents of the indicated disk sector.
 struct buf*
 bread(uint dev, uint sector)
 {
   struct buf *b;
 
   b = bget(dev, sector);
+  if(b->flags & B_RA){
+    b->flags &= ~B_RA;
+    __sync_fetch_and_add(&bcache.rahits, 1);
+  }
   if(!(b->flags & B_VALID))
     iderw(b);
   return b;
 }
 
-// Write b's contents to disk.  Must be B_BUSY.
+// Return a locked buf for the indicated disk sector without
+// reading it, for a caller that will overwrite all its data.
+struct buf*
+bfresh(uint dev, uint sector)
+{
+  struct buf *b;
+
+  b = bget(dev, sector);
+  b->flags &= ~B_RA;
+  b->flags |= B_VALID;
+  return b;
+}
+
+// Return sector on device dev in a fresh locked buffer
+// to be read, or 0 if it is already cached or every buffer
+// is in use.  Never waits for a free buffer.
+static struct buf*
+bclaim(uint dev, uint sector)
+{
+  struct buf *b;
+  struct bucket *bk;
+
+  bk = &bcache.bucket[BHASH(dev, sector)];
+  acquire(&bk->lock);
+  b = blookup(bk, dev, sector);
+  release(&bk->lock);
+  if(b)
+    return 0;
+
+  acquire(&bcache.lock);
+  acquire(&bk->lock);
+  if(blookup(bk, dev, sector) != 0 || (b = bvictim(bk)) == 0){
+    release(&bk->lock);
+    release(&bcache.lock);
+    return 0;
+  }
+  b->dev = dev;
+  b->sector = sector;
+  b->flags = 0;
+  b->refcnt = 1;
+  b->used = 0;
+  release(&bk->lock);
+  release(&bcache.lock);
+
+  // Only sleeps if a bread got in first, in
+  // which case that bread has read the block.
+  acquiresleep(&b->lock);
+  if(b->flags & B_VALID){
+    brelse(b);
+    return 0;
+  }
+  return b;
+}
+
+// Start reading the indicated disk sectors into the cache
+// without waiting for them, skipping any already cached,
+// in batches of up to NBATCH requests.  The disk driver
+// releases each buffer with bdone when its read completes.
+void
+bprefetch(uint dev, uint *sectors, int n)
+{
+  struct buf *b, *bs[NBATCH];
+  int i, m;
+
+  m = 0;
+  for(i = 0; i < n; i++){
+    if((b = bclaim(dev, sectors[i])) == 0)
+      continue;
+    b->flags |= B_RA;
+    b->iodone = bdone;
+    bs[m++] = b;
+    if(m == NBATCH){
+      __sync_fetch_and_add(&bcache.raissued, m);
+      idesubmit(bs, m);
+      m = 0;
+    }
+  }
+  if(m > 0){
+    __sync_fetch_and_add(&bcache.raissued, m);
+    idesubmit(bs, m);
+  }
+}
+
+//PAGEBREAK!
+// Asynchronous interface.  breadn and bwriten start I/O on
+// several buffers in one batch and return without waiting;
+// the caller owns the locked buffers and must bwait on each
+// before using or releasing it.
+
+// Return locked bufs for n sectors on device dev in bs[],
+// starting reads of those not yet valid.
+void
+breadn(uint dev, uint *sectors, int n, struct buf **bs)
+{
+  struct buf *b, *io[NBATCH];
+  int i, m;
+
+  m = 0;
+  for(i = 0; i < n; i++){
+    bs[i] = b = bget(dev, sectors[i]);
+    if(b->flags & B_RA){
+      b->flags &= ~B_RA;
+      __sync_fetch_and_add(&bcache.rahits, 1);
+    }
+    if(!(b->flags & B_VALID))
+      io[m++] = b;
+    if(m == NBATCH){
+      idesubmit(io, m);
+      m = 0;
+    }
+  }
+  if(m > 0)
+    idesubmit(io, m);
+}
+
+// Start reading one sector; see breadn.
+struct buf*
+breadasync(uint dev, uint sector)
+{
+  struct buf *b;
+
+  breadn(dev, &sector, 1, &b);
+  return b;
+}
+
+// Start writing n locked bufs to disk.
+void
+bwriten(struct buf **bs, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++){
+    if(!holdingsleep(&bs[i]->lock))
+      panic("bwriten");
+    bs[i]->flags |= B_DIRTY;
+  }
+  idesubmit(bs, n);
+}
+
+// Start writing one locked buf; see bwriten.
+void
+bwriteasync(struct buf *b)
+{
+  bwriten(&b, 1);
+}
+
+// Wait for the I/O started on locked buf b to finish.
+void
+bwait(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bwait");
+  ideawait(b);
+}
+
+// Write every dirty buffer of dev to disk, NBATCH at a
+// time, and wait for the writes to finish.  The caller
+// must keep others from dirtying buffers meanwhile.
+void
+bflush(uint dev)
+{
+  struct buf *b, *bs[NBATCH];
+  struct bucket *bk;
+  int i, n, m;
+
+  do {
+    // Collect and reference a batch of dirty buffers.
+    n = 0;
+    acquire(&bcache.lock);
+    b = bcache.hand;
+    for(i = 0; i < bcache.nbuf && n < NBATCH; i++, b = b->next){
+      if(b->dev != dev || !(b->flags & B_DIRTY))
+        continue;
+      bk = &bcache.bucket[BHASH(b->dev, b->sector)];
+      acquire(&bk->lock);
+      b->refcnt++;
+      release(&bk->lock);
+      bs[n++] = b;
+    }
+    release(&bcache.lock);
+
+    m = 0;
+    for(i = 0; i < n; i++){
+      acquiresleep(&bs[i]->lock);
+      if(bs[i]->flags & B_DIRTY)
+        bs[m++] = bs[i];
+      else
+        brelse(bs[i]);
+    }
+    if(m > 0)
+      bwriten(bs, m);
+    for(i = 0; i < m; i++){
+      bwait(bs[i]);
+      brelse(bs[i]);
+    }
+  } while(n == NBATCH);
+}
+
+// Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
 {
-  if((b->flags & B_BUSY) == 0)
+  if(!holdingsleep(&b->lock))
     panic("bwrite");
   b->flags |= B_DIRTY;
   iderw(b);
 }
 
-// Release a B_BUSY buffer.
-// Move to the head of the MRU list.
+// Drop a reference to b, which is no longer locked.
+// Mark it recently used for the CLOCK sweep.
+static void
+bunref(struct buf *b)
+{
+  struct bucket *bk;
+
+  // b cannot change buckets while refcnt > 0.
+  bk = &bcache.bucket[BHASH(b->dev, b->sector)];
+  acquire(&bk->lock);
+  b->refcnt--;
+  b->used = 1;
+  release(&bk->lock);
+
+  // Wake anyone waiting in bget for a free buffer.
+  // bget counts itself in nwait before it checks refcnt
+  // and sleeps holding bcache.lock.  Releasing bk->lock
+  // orders the refcnt update before this read of nwait.
+  if(__atomic_load_n(&bcache.nwait, __ATOMIC_SEQ_CST)){
+    acquire(&bcache.lock);
+    wakeup(&bcache);
+    release(&bcache.lock);
+  }
+}
+
+// Release a locked buffer.
 void
 brelse(struct buf *b)
 {
-  if((b->flags & B_BUSY) == 0)
+  if(!holdingsleep(&b->lock))
     panic("brelse");
 
-  acquire(&bcache.lock);
+  releasesleep(&b->lock);
+  bunref(b);
+}
 
-  b->next->prev = b->prev;
-  b->prev->next = b->next;
-  b->next = bcache.head.next;
-  b->prev = &bcache.head;
-  bcache.head.next->prev = b;
-  bcache.head.next = b;
+// Keep locked buf b in the cache after it is released,
+// until a matching bunpin.  The log pins the blocks of a
+// transaction until they have been written home.
+void
+bpin(struct buf *b)
+{
+  struct bucket *bk;
 
-  b->flags &= ~B_BUSY;
-  wakeup(b);
+  if(!holdingsleep(&b->lock))
+    panic("bpin");
+  bk = &bcache.bucket[BHASH(b->dev, b->sector)];
+  acquire(&bk->lock);
+  b->refcnt++;
+  release(&bk->lock);
+}
 
-  release(&bcache.lock);
+// Undo a bpin.  b need not be locked.
+void
+bunpin(struct buf *b)
+{
+  bunref(b);
+}
+
+// I/O completion callback that releases the buffer, for
+// I/O that no process waits for.  Called by the disk driver,
+// possibly in an interrupt, on behalf of the process that
+// started the I/O.
+void
+bdone(struct buf *b)
+{
+  b->iodone = 0;
+  releasesleep(&b->lock);
+  bunref(b);
+}
+
+//PAGEBREAK!
+// Print buffer cache statistics.
+// Runs when user types ^B on console.
+// No lock, like procdump, so counts may be slightly stale.
+void
+bcachedump(void)
+{
+  struct bucket *bk;
+  uint64 hits;
+
+  hits = 0;
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++)
+    hits += bk->hits;
+  cprintf("bcache: %d bufs (%d empty) hit %l miss %l evict %l grow %l shrink %l\n",
+          bcache.nbuf, bcache.nempty, hits, bcache.misses,
+          bcache.evictions, bcache.grows, bcache.shrinks);
+  cprintf("readahead: issued %l hit %l wasted %l\n",
+          bcache.raissued, bcache.rahits, bcache.rawasted);
 }
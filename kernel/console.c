@@ -9,6 +9,7 @@
 #include "param.h"
 #include "traps.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "fs.h"
 #include "file.h"
 #include "memlayout.h"
@@ -57,9 +58,25 @@ printint(int xx, int base, int sign)
   while(--i >= 0)
     consputc(buf[i]);
 }
+
+static void
+printlong(uint64 x)
+{
+  char buf[20];
+  int i;
+
+  i = 0;
+  do{
+    buf[i++] = digits[x % 10];
+  }while((x /= 10) != 0);
+
+  while(--i >= 0)
+    consputc(buf[i]);
+}
 //PAGEBREAK: 50
 
-// Print to the console. only understands %d, %x, %p, %s.
+// Print to the console. only understands %d, %x, %p, %s,
+// and %l for an unsigned 64-bit decimal.
 void
 cprintf(char *fmt, ...)
 {
@@ -94,6 +111,9 @@ cprintf(char *fmt, ...)
     case 'p':
       printptr(va_arg(ap, uint64));
       break;
+    case 'l':
+      printlong(va_arg(ap, uint64));
+      break;
     case 's':
       if((s = va_arg(ap, char*)) == 0)
         s = "(null)";
@@ -211,6 +231,14 @@ consoleintr(int (*getc)(void))
     case C('P'):  // Process listing.
       procdump();
       break;
+    case C('B'):  // Block I/O statistics.
+      bcachedump();
+      pcachedump();
+      idedump();
+      break;
+    case C('T'):  // Lock statistics.
+      lockdump();
+      break;
     case C('U'):  // Kill line.
       while(input.e != input.w &&
             input.buf[(input.e-1) % INPUT_BUF] != '\n'){
@@ -22,7 +22,7 @@ exec(char *path, char **argv)
 
   if((ip = namei(path)) == 0)
     return -1;
-  ilock(ip);
+  ilockshared(ip);
   pml4 = 0;
 
   // Check ELF header
@@ -5,9 +5,16 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "mmu.h"
+#include "stat.h"
+#include "spinlock.h"
+#include "sleeplock.h"
 #include "fs.h"
 #include "file.h"
-#include "spinlock.h"
+#include "fcntl.h"
+#include "buf.h"
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
 
 struct devsw devsw[NDEV];
 struct {
@@ -78,12 +85,27 @@ fileclose(struct file *f)
   }
 }
 
+// Perform control operation cmd on file f.
+int
+filectl(struct file *f, int cmd, int arg)
+{
+  if(f->type != FD_PIPE)
+    return -1;
+  switch(cmd){
+  case F_GETPIPE_SZ:
+    return pipesize(f->pipe);
+  case F_SETPIPE_SZ:
+    return piperesize(f->pipe, arg);
+  }
+  return -1;
+}
+
 // Get metadata about file f.
 int
 filestat(struct file *f, struct stat *st)
 {
   if(f->type == FD_INODE){
-    ilock(f->ip);
+    ilockshared(f->ip);
     stati(f->ip, st);
     iunlock(f->ip);
     return 0;
@@ -91,65 +113,325 @@ filestat(struct file *f, struct stat *st)
   return -1;
 }
 
-// Read from file f.
+// Force f's writes, and all others so far, to disk.
 int
-fileread(struct file *f, char *addr, int n)
+filesync(struct file *f)
 {
-  int r;
+  if(f->type == FD_INODE){
+    log_sync();
+    return 0;
+  }
+  return -1;
+}
+
+// Read from inode ip at *off into the vectors in iov,
+// advancing *off.  Stops at the first short read.
+// Devices fill at most one vector, since a second read
+// could block after the first one returned data.
+// Readers share the inode lock unless excl is set.
+static int
+readiv(struct inode *ip, struct iovec *iov, int iovcnt, uint *off, int excl)
+{
+  int i, r, tot;
+
+  tot = 0;
+  if(excl)
+    ilock(ip);
+  else
+    ilockshared(ip);
+  for(i = 0; i < iovcnt; i++){
+    if(iov[i].len == 0)
+      continue;
+    if((r = readi(ip, iov[i].base, *off, iov[i].len)) < 0){
+      if(tot == 0)
+        tot = -1;
+      break;
+    }
+    *off += r;
+    tot += r;
+    if(r < iov[i].len || ip->type == T_DEV)
+      break;
+  }
+  iunlock(ip);
+  return tot;
+}
+
+//PAGEBREAK!
+// Write the vectors in iov to inode ip at *off, advancing *off.
+// The vectors land contiguously in the file, so they are packed
+// into as few log transactions as the per-transaction byte
+// limit allows instead of one transaction per vector.
+static int
+writeiv(struct inode *ip, struct iovec *iov, int iovcnt, uint *off)
+{
+  // write a few blocks at a time to avoid exceeding
+  // the maximum log transaction size, including
+  // i-node, indirect block, allocation blocks,
+  // and 2 blocks of slop for non-aligned writes.
+  // this really belongs lower down, since writei()
+  // might be writing a device like the console.
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+  int i, done, n, n1, r, tot;
+
+  tot = 0;
+  i = 0;
+  done = 0;  // bytes of iov[i] already written
+  r = 0;
+  while(i < iovcnt){
+    begin_trans();
+    ilock(ip);
+    for(n = 0; i < iovcnt && n < max; n += r){
+      n1 = iov[i].len - done;
+      if(n1 > max - n)
+        n1 = max - n;
+      if((r = writei(ip, (char*)iov[i].base + done, *off, n1)) < 0)
+        break;
+      if(r != n1)
+        panic("short filewrite");
+      *off += r;
+      done += r;
+      tot += r;
+      if(done == iov[i].len){
+        i++;
+        done = 0;
+      }
+    }
+    iunlock(ip);
+    commit_trans();
+
+    if(r < 0)
+      return -1;
+  }
+  return tot;
+}
+
+// Read from file f into the vectors in iov.
+int
+filereadv(struct file *f, struct iovec *iov, int iovcnt)
+{
+  int i;
 
   if(f->readable == 0)
     return -1;
-  if(f->type == FD_PIPE)
-    return piperead(f->pipe, addr, n);
-  if(f->type == FD_INODE){
-    ilock(f->ip);
-    if((r = readi(f->ip, addr, f->off, n)) > 0)
-      f->off += r;
-    iunlock(f->ip);
-    return r;
+  if(f->type == FD_PIPE){
+    // A pipe read returns whatever is buffered, so
+    // fill only the first non-empty vector.
+    for(i = 0; i < iovcnt; i++)
+      if(iov[i].len > 0)
+        return piperead(f->pipe, iov[i].base, iov[i].len);
+    return 0;
   }
-  panic("fileread");
+  if(f->type == FD_INODE)
+    // Processes sharing f also share f->off, so their
+    // reads must not overlap.
+    return readiv(f->ip, iov, iovcnt, &f->off, f->ref > 1);
+  panic("filereadv");
+}
+
+// Read from file f.
+int
+fileread(struct file *f, char *addr, int n)
+{
+  struct iovec iov;
+
+  iov.base = addr;
+  iov.len = n;
+  return filereadv(f, &iov, 1);
+}
+
+// Read from file f at offset off without using or
+// changing the file offset.
+int
+filepread(struct file *f, char *addr, int n, uint off)
+{
+  struct iovec iov;
+
+  if(f->readable == 0 || f->type != FD_INODE)
+    return -1;
+  iov.base = addr;
+  iov.len = n;
+  return readiv(f->ip, &iov, 1, &off, 0);
 }
 
 //PAGEBREAK!
+// Write the vectors in iov to file f.
+int
+filewritev(struct file *f, struct iovec *iov, int iovcnt)
+{
+  int i, r, tot;
+
+  if(f->writable == 0)
+    return -1;
+  if(f->type == FD_PIPE){
+    tot = 0;
+    for(i = 0; i < iovcnt; i++){
+      if((r = pipewrite(f->pipe, iov[i].base, iov[i].len)) < 0)
+        return -1;
+      tot += r;
+    }
+    return tot;
+  }
+  if(f->type == FD_INODE)
+    return writeiv(f->ip, iov, iovcnt, &f->off);
+  panic("filewritev");
+}
+
 // Write to file f.
 int
 filewrite(struct file *f, char *addr, int n)
 {
-  int r;
+  struct iovec iov;
 
-  if(f->writable == 0)
+  iov.base = addr;
+  iov.len = n;
+  if(filewritev(f, &iov, 1) != n)
     return -1;
-  if(f->type == FD_PIPE)
-    return pipewrite(f->pipe, addr, n);
-  if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
-    // this really belongs lower down, since writei()
-    // might be writing a device like the console.
-    int max = ((LOGSIZE-1-1-2) / 2) * 512;
-    int i = 0;
-    while(i < n){
-      int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
-
-      begin_trans();
-      ilock(f->ip);
-      if ((r = writei(f->ip, addr + i, f->off, n1)) > 0)
-        f->off += r;
-      iunlock(f->ip);
-      commit_trans();
-
-      if(r < 0)
-        break;
-      if(r != n1)
-        panic("short filewrite");
-      i += r;
+  return n;
+}
+
+// Write to file f at offset off without using or
+// changing the file offset.
+int
+filepwrite(struct file *f, char *addr, int n, uint off)
+{
+  struct iovec iov;
+
+  if(f->writable == 0 || f->type != FD_INODE)
+    return -1;
+  iov.base = addr;
+  iov.len = n;
+  if(writeiv(f->ip, &iov, 1, &off) != n)
+    return -1;
+  return n;
+}
+
+// Reposition the offset of file f.
+// xv6 files have no holes, so the new offset
+// may not lie past the end of the file.
+int
+fileseek(struct file *f, int off, int whence)
+{
+  int base;
+
+  if(f->type != FD_INODE)
+    return -1;
+  ilock(f->ip);
+  if(f->ip->type == T_DEV){
+    iunlock(f->ip);
+    return -1;
+  }
+  switch(whence){
+  case SEEK_SET:
+    base = 0;
+    break;
+  case SEEK_CUR:
+    base = f->off;
+    break;
+  case SEEK_END:
+    base = f->ip->size;
+    break;
+  default:
+    iunlock(f->ip);
+    return -1;
+  }
+  if(base + off < 0 || base + off > f->ip->size){
+    iunlock(f->ip);
+    return -1;
+  }
+  f->off = base + off;
+  iunlock(f->ip);
+  return f->off;
+}
+
+//PAGEBREAK!
+// Move up to n bytes from regular file f into pipe p,
+// copying straight out of the buffer cache into the pipe.
+// The pipe is filled without sleeping while a buffer is
+// held; the wait for space happens with nothing locked.
+// Processes sharing f also share f->off, so they take
+// the inode lock exclusively and advance f->off under it.
+static int
+sendpipe(struct pipe *p, struct file *f, int n)
+{
+  struct inode *ip;
+  struct buf *bp;
+  int m, r, tot, excl;
+
+  ip = f->ip;
+  excl = f->ref > 1;
+  for(tot = 0; tot < n; ){
+    if(excl)
+      ilock(ip);
+    else
+      ilockshared(ip);
+    if(f->off >= ip->size){
+      iunlock(ip);
+      break;
+    }
+    m = min(n - tot, BSIZE - f->off%BSIZE);
+    m = min(m, ip->size - f->off);
+    bp = ibread(ip, f->off);
+    r = pipeput(p, (char*)bp->data + f->off%BSIZE, m);
+    brelse(bp);
+    if(r > 0)
+      f->off += r;
+    iunlock(ip);
+    if(r == 0)
+      r = pipewaitspace(p);
+    if(r < 0)
+      return tot > 0 ? tot : -1;
+    tot += r;
+  }
+  return tot;
+}
+
+// Move up to n bytes from in to out through a kernel page,
+// for pairs that have no direct path.  Stops after a short
+// read, so a pipe source returns what it has buffered.
+static int
+sendcopy(struct file *out, struct file *in, int n)
+{
+  char *buf;
+  int m, r, tot;
+
+  if((buf = kalloc()) == 0)
+    return -1;
+  r = 0;
+  for(tot = 0; tot < n; tot += r){
+    m = min(n - tot, PGSIZE);
+    if((r = fileread(in, buf, m)) <= 0)
+      break;
+    if(filewrite(out, buf, r) != r){
+      r = -1;
+      break;
+    }
+    if(r < m){
+      tot += r;
+      break;
     }
-    return i == n ? n : -1;
   }
-  panic("filewrite");
+  kfree(buf);
+  if(r < 0 && tot == 0)
+    return -1;
+  return tot;
+}
+
+// Move up to n bytes from file in, at its offset, to file
+// out without copying through user space.
+// Returns the number of bytes moved, 0 at end of file.
+int
+filesend(struct file *out, struct file *in, int n)
+{
+  int dev;
+
+  if(in->readable == 0 || out->writable == 0 || n < 0)
+    return -1;
+  if(in->type == FD_INODE && out->type == FD_PIPE){
+    ilockshared(in->ip);
+    dev = in->ip->type == T_DEV;
+    iunlock(in->ip);
+    if(!dev)
+      return sendpipe(out->pipe, in, n);
+  }
+  return sendcopy(out, in, n);
 }
@@ -16,12 +16,17 @@
 #include "mmu.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "buf.h"
+#include "pcache.h"
 #include "fs.h"
 #include "file.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 static void itrunc(struct inode*);
+static void ixdrop(struct inode*);
+
+static struct superblock sb;  // ROOTDEV's, read once by fsinit
 
 // Read the super block.
 void
@@ -32,6 +37,8 @@ readsb(int dev, struct superblock *sb)
   bp = bread(dev, 1);
   memmove(sb, bp->data, sizeof(*sb));
   brelse(bp);
+  if(sb->bsize != BSIZE)
+    panic("readsb: file system block size");
 }
 
 // Zero a block.
@@ -42,35 +49,124 @@ bzero(int dev, int bno)
 
   bp = bread(dev, bno);
   memset(bp->data, 0, BSIZE);
-  log_write(bp);
+  log_data(bp);  // logged instead if it becomes metadata
   brelse(bp);
 }
 
 // Blocks.
+//
+// fsfree counts, for each bitmap block, the free data blocks
+// it covers, so balloc skips full bitmap blocks without
+// reading them and statfs needs no disk I/O.  balloc and
+// bfree change a count while they hold the bitmap buf that
+// the bit lives in; the spin lock covers only the counts.
+// xv6 mounts one file system, on ROOTDEV.
 
-// Allocate a zeroed disk block.
-static uint
-balloc(uint dev)
+#define MAXBMAP 64  // most bitmap blocks
+
+static struct {
+  struct spinlock lock;
+  uint bmapstart;       // first bitmap block
+  uint datastart;       // first data block
+  uint dataend;         // end of the data blocks; the log follows
+  uint nbmap;           // bitmap blocks covering data blocks
+  uint nfree[MAXBMAP];  // free data blocks per bitmap block
+  uint total;           // free data blocks
+  uint next;            // default place to start looking
+} fsfree;
+
+static void iinitmap(int);
+
+// Read dev's super block and count its free blocks and inodes.
+// Called once, after log recovery.
+void
+fsinit(int dev)
 {
-  int b, bi, m;
+  uint b, bi;
   struct buf *bp;
-  struct superblock sb;
 
-  bp = 0;
+  initlock(&fsfree.lock, "fsfree");
   readsb(dev, &sb);
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb.ninodes));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
-        brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
-      }
+  fsfree.bmapstart = BBLOCK(0, sb.ninodes);
+  fsfree.dataend = sb.size - sb.nlog;
+  fsfree.datastart = fsfree.dataend - sb.nblocks;
+  fsfree.nbmap = (fsfree.dataend + BPB - 1) / BPB;
+  if(fsfree.nbmap > MAXBMAP)
+    panic("fsinit: too many bitmap blocks");
+  for(b = 0; b < fsfree.dataend; b += BPB){
+    bp = bread(dev, fsfree.bmapstart + b/BPB);
+    for(bi = 0; bi < BPB && b + bi < fsfree.dataend; bi++){
+      if(b + bi >= fsfree.datastart && (bp->data[bi/8] & (1 << (bi % 8))) == 0)
+        fsfree.nfree[b/BPB]++;
     }
     brelse(bp);
+    fsfree.total += fsfree.nfree[b/BPB];
+  }
+  fsfree.next = fsfree.datastart;
+  iinitmap(dev);
+}
+
+// Allocate the first free block in [lo, hi), which must lie
+// within bitmap block n.  Returns 0 if there is none.
+static uint
+bscan(uint dev, uint n, uint lo, uint hi)
+{
+  uint b, bi, m;
+  struct buf *bp;
+
+  bp = bread(dev, fsfree.bmapstart + n);
+  for(b = lo; b < hi; b++){
+    bi = b % BPB;
+    if(bi % 8 == 0 && bp->data[bi/8] == 0xff){
+      b += 7;  // skip a full byte
+      continue;
+    }
+    m = 1 << (bi % 8);
+    if((bp->data[bi/8] & m) == 0){  // Is block free?
+      bp->data[bi/8] |= m;  // Mark block in use.
+      log_write(bp);
+      acquire(&fsfree.lock);
+      fsfree.nfree[n]--;
+      fsfree.total--;
+      fsfree.next = b + 1 < fsfree.dataend ? b + 1 : fsfree.datastart;
+      release(&fsfree.lock);
+      brelse(bp);
+      bzero(dev, b);
+      return b;
+    }
+  }
+  brelse(bp);
+  return 0;
+}
+
+// Allocate a zeroed disk block: near if it is free, else the
+// next free block after it.  near is 0 for no preference,
+// which continues after the last block allocated.
+static uint
+balloc(uint dev, uint near)
+{
+  uint i, n, nfree, lo, hi, b;
+
+  acquire(&fsfree.lock);
+  if(near < fsfree.datastart || near >= fsfree.dataend)
+    near = fsfree.next;
+  release(&fsfree.lock);
+
+  // Visit near's bitmap block from near on, then the others
+  // in turn, then near's block again for the blocks before near.
+  for(i = 0; i <= fsfree.nbmap; i++){
+    n = (near/BPB + i) % fsfree.nbmap;
+    acquire(&fsfree.lock);
+    nfree = fsfree.nfree[n];
+    release(&fsfree.lock);
+    if(nfree == 0)
+      continue;
+    lo = i == 0 ? near : n*BPB;
+    if(lo < fsfree.datastart)
+      lo = fsfree.datastart;
+    hi = i == fsfree.nbmap ? near : min((n+1)*BPB, fsfree.dataend);
+    if((b = bscan(dev, n, lo, hi)) != 0)
+      return b;
   }
   panic("balloc: out of blocks");
 }
@@ -80,17 +176,21 @@ static void
 bfree(int dev, uint b)
 {
   struct buf *bp;
-  struct superblock sb;
   int bi, m;
 
-  readsb(dev, &sb);
-  bp = bread(dev, BBLOCK(b, sb.ninodes));
+  if(b < fsfree.datastart || b >= fsfree.dataend)
+    panic("bfree: not a data block");
+  bp = bread(dev, fsfree.bmapstart + b/BPB);
   bi = b % BPB;
   m = 1 << (bi % 8);
   if((bp->data[bi/8] & m) == 0)
     panic("freeing free block");
   bp->data[bi/8] &= ~m;
   log_write(bp);
+  acquire(&fsfree.lock);
+  fsfree.nfree[b/BPB]++;
+  fsfree.total++;
+  release(&fsfree.lock);
   brelse(bp);
 }
 
@@ -134,9 +234,11 @@ bfree(int dev, uint b)
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
-//   has first locked the inode. The I_BUSY flag indicates
-//   that the inode is locked. ilock() sets I_BUSY,
-//   while iunlock clears it.
+//   has first locked the inode with ip->lock, a reader-writer
+//   sleep lock. ilock() locks it exclusively, for code that
+//   modifies the inode or its content; ilockshared() lets
+//   any number of readers (readi, dirlookup, path lookup,
+//   exec) in at once. iunlock() releases either kind.
 //
 // Thus a typical sequence is:
 //   ip = iget(dev, inum)
@@ -164,37 +266,120 @@ struct {
 void
 iinit(void)
 {
+  int i;
+
   initlock(&icache.lock, "icache");
+  for(i = 0; i < NINODE; i++){
+    initrwsleeplock(&icache.inode[i].lock, "inode");
+    initlock(&icache.inode[i].maplock, "inode map");
+  }
 }
 
 static struct inode* iget(uint dev, uint inum);
 
+// imap is an in-memory bitmap of the inodes in use, built by
+// fsinit, so ialloc finds a free inode without reading inode
+// blocks.  Every inode below imap.next is in use.
+static struct {
+  struct spinlock lock;
+  uint *bits;  // bit i set if inode i is in use
+  uint next;   // where to start looking
+  uint nfree;  // free inodes
+} imap;
+
+// Build imap from dev's inode blocks.
+static void
+iinitmap(int dev)
+{
+  uint inum;
+  struct buf *bp;
+  struct dinode *dip;
+
+  initlock(&imap.lock, "imap");
+  if(sb.ninodes > PGSIZE*8 || (imap.bits = (uint*)kalloc()) == 0)
+    panic("iinitmap");
+  memset(imap.bits, 0, PGSIZE);
+  imap.bits[0] = 1;  // inode 0 is never used
+  bp = 0;
+  for(inum = 1; inum < sb.ninodes; inum++){
+    if(bp == 0 || inum%IPB == 0){
+      if(bp)
+        brelse(bp);
+      bp = bread(dev, IBLOCK(inum));
+    }
+    dip = (struct dinode*)bp->data + inum%IPB;
+    if(dip->type != 0)
+      imap.bits[inum/32] |= 1U << (inum%32);
+    else
+      imap.nfree++;
+  }
+  if(bp)
+    brelse(bp);
+  imap.next = 1;
+}
+
+// Record in imap that inode inum is free again.
+static void
+imapfree(uint inum)
+{
+  acquire(&imap.lock);
+  imap.bits[inum/32] &= ~(1U << (inum%32));
+  if(inum < imap.next)
+    imap.next = inum;
+  imap.nfree++;
+  release(&imap.lock);
+}
+
 //PAGEBREAK!
 // Allocate a new inode with the given type on device dev.
 // A free inode has a type of zero.
 struct inode*
 ialloc(uint dev, short type)
 {
-  int inum;
+  uint inum;
   struct buf *bp;
   struct dinode *dip;
-  struct superblock sb;
-
-  readsb(dev, &sb);
 
-  for(inum = 1; inum < sb.ninodes; inum++){
-    bp = bread(dev, IBLOCK(inum));
-    dip = (struct dinode*)bp->data + inum%IPB;
-    if(dip->type == 0){  // a free inode
-      memset(dip, 0, sizeof(*dip));
-      dip->type = type;
-      log_write(bp);   // mark it allocated on the disk
-      brelse(bp);
-      return iget(dev, inum);
+  acquire(&imap.lock);
+  for(inum = imap.next; inum < sb.ninodes; inum++){
+    if(inum%32 == 0 && imap.bits[inum/32] == ~0U){
+      inum += 31;  // skip a full word
+      continue;
     }
-    brelse(bp);
+    if((imap.bits[inum/32] & (1U << (inum%32))) == 0)
+      break;
   }
-  panic("ialloc: no inodes");
+  if(inum >= sb.ninodes)
+    panic("ialloc: no inodes");
+  imap.bits[inum/32] |= 1U << (inum%32);
+  imap.next = inum + 1;
+  imap.nfree--;
+  release(&imap.lock);
+
+  bp = bread(dev, IBLOCK(inum));
+  dip = (struct dinode*)bp->data + inum%IPB;
+  if(dip->type != 0)
+    panic("ialloc: inode in use");
+  memset(dip, 0, sizeof(*dip));
+  dip->type = type;
+  log_write(bp);   // mark it allocated on the disk
+  brelse(bp);
+  return iget(dev, inum);
+}
+
+// Fill in st for the file system on dev.
+void
+fsstat(uint dev, struct statfs *st)
+{
+  st->bsize = BSIZE;
+  st->blocks = sb.nblocks;
+  st->files = sb.ninodes;
+  acquire(&fsfree.lock);
+  st->bfree = fsfree.total;
+  release(&fsfree.lock);
+  acquire(&imap.lock);
+  st->ffree = imap.nfree;
+  release(&imap.lock);
 }
 
 // Copy a modified in-memory inode to disk.
@@ -211,6 +396,7 @@ iupdate(struct inode *ip)
   dip->minor = ip->minor;
   dip->nlink = ip->nlink;
   dip->size = ip->size;
+  dip->index = ip->index;
   memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
   log_write(bp);
   brelse(bp);
@@ -246,6 +432,8 @@ iget(uint dev, uint inum)
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
+  ip->ranext = ip->raend = ip->rawin = 0;
+  ip->maplen = ip->leaf = 0;
   ip->flags = 0;
   release(&icache.lock);
 
@@ -263,23 +451,14 @@ idup(struct inode *ip)
   return ip;
 }
 
-// Lock the given inode.
-// Reads the inode from disk if necessary.
-void
-ilock(struct inode *ip)
+// Read the inode from disk if necessary.
+// Caller must hold ip->lock exclusively.
+static void
+iload(struct inode *ip)
 {
   struct buf *bp;
   struct dinode *dip;
 
-  if(ip == 0 || ip->ref < 1)
-    panic("ilock");
-
-  acquire(&icache.lock);
-  while(ip->flags & I_BUSY)
-    sleep(ip, &icache.lock);
-  ip->flags |= I_BUSY;
-  release(&icache.lock);
-
   if(!(ip->flags & I_VALID)){
     bp = bread(ip->dev, IBLOCK(ip->inum));
     dip = (struct dinode*)bp->data + ip->inum%IPB;
@@ -288,6 +467,7 @@ ilock(struct inode *ip)
     ip->minor = dip->minor;
     ip->nlink = dip->nlink;
     ip->size = dip->size;
+    ip->index = dip->index;
     memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
     brelse(bp);
     ip->flags |= I_VALID;
@@ -296,17 +476,45 @@ ilock(struct inode *ip)
   }
 }
 
+// Lock the given inode exclusively.
+// Reads the inode from disk if necessary.
+void
+ilock(struct inode *ip)
+{
+  if(ip == 0 || ip->ref < 1)
+    panic("ilock");
+
+  acquirewrite(&ip->lock);
+  iload(ip);
+}
+
+// Lock the given inode shared with other readers,
+// who may only examine the inode and its content.
+// Reads the inode from disk if necessary, holding
+// the lock exclusively while doing so.
+void
+ilockshared(struct inode *ip)
+{
+  if(ip == 0 || ip->ref < 1)
+    panic("ilockshared");
+
+  acquireread(&ip->lock);
+  if(!(ip->flags & I_VALID)){
+    releaserw(&ip->lock);
+    acquirewrite(&ip->lock);
+    iload(ip);
+    downgradewrite(&ip->lock);
+  }
+}
+
 // Unlock the given inode.
 void
 iunlock(struct inode *ip)
 {
-  if(ip == 0 || !(ip->flags & I_BUSY) || ip->ref < 1)
+  if(ip == 0 || !holdingrw(&ip->lock) || ip->ref < 1)
     panic("iunlock");
 
-  acquire(&icache.lock);
-  ip->flags &= ~I_BUSY;
-  wakeup(ip);
-  release(&icache.lock);
+  releaserw(&ip->lock);
 }
 
 // Drop a reference to an in-memory inode.
@@ -319,17 +527,18 @@ iput(struct inode *ip)
 {
   acquire(&icache.lock);
   if(ip->ref == 1 && (ip->flags & I_VALID) && ip->nlink == 0){
-    // inode has no links: truncate and free inode.
-    if(ip->flags & I_BUSY)
-      panic("iput busy");
-    ip->flags |= I_BUSY;
+    // inode has no links and no other references:
+    // truncate and free inode.  No one else can
+    // hold or wait for the lock, so this does not sleep.
     release(&icache.lock);
+    acquirewrite(&ip->lock);
     itrunc(ip);
     ip->type = 0;
     iupdate(ip);
-    acquire(&icache.lock);
+    imapfree(ip->inum);
     ip->flags = 0;
-    wakeup(ip);
+    releaserw(&ip->lock);
+    acquire(&icache.lock);
   }
   ip->ref--;
   release(&icache.lock);
@@ -349,38 +558,157 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT], the next NDINDIRECT
+// through the double indirect block ip->addrs[NDIRECT+1],
+// and the last NTINDIRECT through the triple indirect block
+// ip->addrs[NDIRECT+2].
+//
+// Each inode caches the run of contiguous disk blocks that
+// bmap found last, and the lowest indirect block it read, so
+// sequential access skips most indirect block reads.  Shared
+// holders of the inode lock all use the cache, so it has a
+// spin lock of its own.
+
+// Return the cached disk address of block bn of ip, or 0.
+// Sets *leaf to a cached indirect block that maps bn, or 0,
+// and *near to the disk block that would continue the cached
+// run up to bn, or 0.
+static uint
+mapcached(struct inode *ip, uint bn, uint *leaf, uint *near)
+{
+  uint addr;
+
+  addr = 0;
+  *leaf = *near = 0;
+  acquire(&ip->maplock);
+  if(bn - ip->mapbn < ip->maplen)
+    addr = ip->mapaddr + (bn - ip->mapbn);
+  else if(ip->leaf && bn - ip->leafbn < NINDIRECT)
+    *leaf = ip->leaf;
+  if(ip->maplen > 0 && bn == ip->mapbn + ip->maplen)
+    *near = ip->mapaddr + ip->maplen;
+  release(&ip->maplock);
+  return addr;
+}
+
+// Remember that block bn of ip is at addr, and that
+// indirect block leaf, if not 0, maps blocks from leafbn.
+static void
+mapcache(struct inode *ip, uint bn, uint addr, uint leaf, uint leafbn)
+{
+  acquire(&ip->maplock);
+  if(ip->maplen > 0 && bn == ip->mapbn + ip->maplen &&
+     addr == ip->mapaddr + ip->maplen)
+    ip->maplen++;
+  else {
+    ip->mapbn = bn;
+    ip->mapaddr = addr;
+    ip->maplen = 1;
+  }
+  if(leaf){
+    ip->leaf = leaf;
+    ip->leafbn = leafbn;
+  }
+  release(&ip->maplock);
+}
+
+// Return entry i of indirect block addr, allocating
+// a block for it, preferably at near, if there is none.
+static uint
+indirect(struct inode *ip, uint addr, uint i, uint near)
+{
+  uint b, *a;
+  struct buf *bp;
+
+  bp = bread(ip->dev, addr);
+  a = (uint*)bp->data;
+  if((b = a[i]) == 0){
+    a[i] = b = balloc(ip->dev, near);
+    log_write(bp);
+  }
+  brelse(bp);
+  return b;
+}
 
 // Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+// If there is no such block, bmap allocates one, right after
+// block bn-1 if possible, so that files stay contiguous.
 static uint
 bmap(struct inode *ip, uint bn)
 {
-  uint addr, *a;
-  struct buf *bp;
+  uint addr, leaf, near, *root;
+  uint64 n, span;
+  int level;
+
+  if((addr = mapcached(ip, bn, &leaf, &near)) != 0)
+    return addr;
 
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
+      ip->addrs[bn] = addr = balloc(ip->dev, near);
+    mapcache(ip, bn, addr, 0, 0);
     return addr;
   }
-  bn -= NDIRECT;
 
-  if(bn < NINDIRECT){
-    // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
-    bp = bread(ip->dev, addr);
-    a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
-      log_write(bp);
+  if(leaf == 0){
+    // Find the tree holding bn: single, double or
+    // triple indirect, and walk down to its leaf.
+    n = bn - NDIRECT;
+    for(level = 0, span = NINDIRECT; n >= span; level++, span *= NINDIRECT){
+      n -= span;
+      if(level == 2)
+        panic("bmap: out of range");
+    }
+    root = &ip->addrs[NDIRECT + level];
+    if(*root == 0)
+      *root = balloc(ip->dev, near);
+    leaf = *root;
+    for(; level > 0; level--){
+      span /= NINDIRECT;
+      leaf = indirect(ip, leaf, n / span, near);
+      n %= span;
     }
-    brelse(bp);
-    return addr;
   }
 
-  panic("bmap: out of range");
+  // Every tree's leaves start NINDIRECT-aligned past NDIRECT.
+  addr = indirect(ip, leaf, (bn - NDIRECT) % NINDIRECT, near);
+  mapcache(ip, bn, addr, leaf, bn - (bn - NDIRECT) % NINDIRECT);
+  return addr;
+}
+
+// Return a locked buf holding the block of ip that contains
+// byte off, so callers can copy file data without going
+// through readi.  Caller must hold ip locked, off must be
+// below ip->size, and the buf must be passed to brelse.
+struct buf*
+ibread(struct inode *ip, uint off)
+{
+  if(off >= ip->size)
+    panic("ibread");
+  return bread(ip->dev, bmap(ip, off/BSIZE));
+}
+
+// Free indirect block addr, with the blocks it maps
+// and, for level > 1, the indirect blocks below it.
+static void
+ifree(uint dev, uint addr, int level)
+{
+  struct buf *bp;
+  uint *a;
+  int j;
+
+  bp = bread(dev, addr);
+  a = (uint*)bp->data;
+  for(j = 0; j < NINDIRECT; j++){
+    if(a[j] == 0)
+      continue;
+    if(level > 1)
+      ifree(dev, a[j], level - 1);
+    else
+      bfree(dev, a[j]);
+  }
+  brelse(bp);
+  bfree(dev, addr);
 }
 
 // Truncate inode (discard contents).
@@ -391,9 +719,9 @@ bmap(struct inode *ip, uint bn)
 static void
 itrunc(struct inode *ip)
 {
-  int i, j;
-  struct buf *bp;
-  uint *a;
+  int i;
+
+  ixdrop(ip);
 
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
@@ -402,18 +730,19 @@ itrunc(struct inode *ip)
     }
   }
 
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
+  // Single, double and triple indirect trees.
+  for(i = 0; i < 3; i++){
+    if(ip->addrs[NDIRECT+i]){
+      ifree(ip->dev, ip->addrs[NDIRECT+i], i + 1);
+      ip->addrs[NDIRECT+i] = 0;
     }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
   }
 
+  acquire(&ip->maplock);
+  ip->maplen = ip->leaf = 0;
+  release(&ip->maplock);
+
+  pinval(ip->dev, ip->inum);
   ip->size = 0;
   iupdate(ip);
 }
@@ -429,6 +758,60 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+#define RAMIN  4  // readahead window once reads look sequential
+#define RAMAX 64  // largest readahead window, in blocks
+
+// Blocks bn..bn+n-1 of ip are about to be read.  Start reading
+// the rest of them, and the next rawin blocks if ip is being
+// read sequentially, without waiting.  The window doubles each
+// time a read starts where the last one stopped (or at the
+// start of the file) and closes when one does not.  Caller
+// must hold ip's lock; shared is enough, since the readahead
+// fields are only hints.
+static void
+readahead(struct inode *ip, uint bn, uint n)
+{
+  uint i, end, sectors[RAMAX+PGSIZE/BSIZE];
+  int m;
+
+  if(bn == ip->ranext)
+    ip->rawin = ip->rawin ? min(2*ip->rawin, RAMAX) : RAMIN;
+  else
+    ip->rawin = 0;
+  ip->ranext = bn + n;
+  end = min(bn + n + ip->rawin, (ip->size + BSIZE-1) / BSIZE);
+  i = bn + 1;
+  if(ip->rawin && ip->raend > i)
+    i = ip->raend;
+  for(m = 0; i < end; i++)
+    sectors[m++] = bmap(ip, i);
+  bprefetch(ip->dev, sectors, m);
+  ip->raend = end;
+}
+
+// Read page pg of ip's data from disk.  Bytes past the
+// end of the file read as zero.  Caller must hold ip's
+// lock and pg's lock.
+static void
+pfill(struct inode *ip, struct page *pg)
+{
+  struct buf *bp;
+  uint off, i;
+
+  off = pg->pgno * PGSIZE;
+  readahead(ip, off/BSIZE, PGSIZE/BSIZE);
+  for(i = 0; i < PGSIZE; i += BSIZE){
+    if(off + i >= ip->size){
+      memset(pg->data + i, 0, PGSIZE - i);
+      break;
+    }
+    bp = bread(ip->dev, bmap(ip, (off + i)/BSIZE));
+    memmove(pg->data + i, bp->data, BSIZE);
+    brelse(bp);
+  }
+  pg->valid = 1;
+}
+
 //PAGEBREAK!
 // Read data from inode.
 int
@@ -436,6 +819,7 @@ readi(struct inode *ip, char *dst, uint off, uint n)
 {
   uint tot, m;
   struct buf *bp;
+  struct page *pg;
 
   if(ip->type == T_DEV){
     if(ip->major < 0 || ip->major >= NDEV || !devsw[ip->major].read)
@@ -449,6 +833,16 @@ readi(struct inode *ip, char *dst, uint off, uint n)
     n = ip->size - off;
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
+    if((pg = pget(ip->dev, ip->inum, off/PGSIZE)) != 0){
+      if(!pg->valid)
+        pfill(ip, pg);
+      m = min(n - tot, PGSIZE - off%PGSIZE);
+      memmove(dst, pg->data + off%PGSIZE, m);
+      pput(pg);
+      continue;
+    }
+    // No page to spare; read through the buffer cache.
+    readahead(ip, off/BSIZE, 1);
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
     memmove(dst, bp->data + off%BSIZE, m);
@@ -464,6 +858,7 @@ writei(struct inode *ip, char *src, uint off, uint n)
 {
   uint tot, m;
   struct buf *bp;
+  struct page *pg;
 
   if(ip->type == T_DEV){
     if(ip->major < 0 || ip->major >= NDEV || !devsw[ip->major].write)
@@ -473,15 +868,22 @@ writei(struct inode *ip, char *src, uint off, uint n)
 
   if(off > ip->size || off + n < off)
     return -1;
-  if(off + n > MAXFILE*BSIZE)
+  if(off + n > (uint64)MAXFILE*BSIZE)
     return -1;
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
     memmove(bp->data + off%BSIZE, src, m);
-    log_write(bp);
+    if(ip->type == T_FILE)
+      log_data(bp);
+    else
+      log_write(bp);
     brelse(bp);
+    if((pg = plookup(ip->dev, ip->inum, off/PGSIZE)) != 0){
+      memmove(pg->data + off%PGSIZE, src, m);
+      pput(pg);
+    }
   }
 
   if(n > 0 && off > ip->size){
@@ -500,6 +902,302 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Directory index.
+//
+// A directory bigger than one block gets a hash index in
+// dp->index (see struct dirindex in fs.h), so lookups read the
+// header, one bucket and only the dirents whose hash matches.
+// The dirents themselves stay where they are, so reading a
+// directory works as before.  The index grows by linear
+// hashing, one bucket split at a time, to keep each
+// transaction's share small.  A full bucket block gets an
+// overflow block chained after it.  Chains are limited, so
+// a split stays small too: if names pile into one bucket
+// anyway, the index is given up for good, and the directory
+// goes back to linear search.
+
+#define IXMAXCHAIN  4  // most blocks in a bucket's chain
+#define IXMAXBUILD  8  // most buckets ixbuild will create
+
+// Does dp have an index?
+#define ixvalid(dp) ((dp)->index != 0 && (dp)->index != DIRNOINDEX)
+
+// FNV-1a hash of a name.  mkfs has a copy.
+static uint
+ixhash(char *name)
+{
+  uint h;
+  int i;
+
+  h = 2166136261U;
+  for(i = 0; i < DIRSIZ && name[i]; i++){
+    h ^= (uchar)name[i];
+    h *= 16777619;
+  }
+  return h;
+}
+
+// Return the bucket for hash h in an index of n buckets:
+// h modulo the power of two at or above n, or modulo half
+// that if the bucket has not been split off yet.
+static uint
+ixbucket(uint h, uint n)
+{
+  uint m;
+
+  for(m = 1; m < n; m <<= 1)
+    ;
+  if((h & (m-1)) < n)
+    return h & (m-1);
+  return h & (m/2 - 1);
+}
+
+// Add a bucket to the index in hbp, taking its entries
+// from the one bucket that held them until now.  The new
+// chain is no longer than the old one.
+static void
+ixsplit(struct inode *dp, struct buf *hbp)
+{
+  struct dirindex *ix;
+  struct dirbucket *src, *dst;
+  struct buf *sbp, *dbp;
+  uint n, m, i, b, next;
+  int moved;
+
+  ix = (struct dirindex*)hbp->data;
+  n = ix->nbucket;
+  if(n == NDIRBUCKET)
+    return;
+  for(m = 1; m < n+1; m <<= 1)
+    ;
+  ix->bucket[n] = balloc(dp->dev, 0);
+  dbp = bread(dp->dev, ix->bucket[n]);
+  dst = (struct dirbucket*)dbp->data;
+  for(b = ix->bucket[n - m/2]; b != 0; b = next){
+    sbp = bread(dp->dev, b);
+    src = (struct dirbucket*)sbp->data;
+    moved = 0;
+    for(i = 0; i < src->n; ){
+      if(ixbucket(src->e[i].hash, n+1) != n){
+        i++;
+        continue;
+      }
+      if(dst->n == NDIRHENT){
+        next = dst->next = balloc(dp->dev, 0);
+        log_write(dbp);
+        brelse(dbp);
+        dbp = bread(dp->dev, next);
+        dst = (struct dirbucket*)dbp->data;
+      }
+      dst->e[dst->n++] = src->e[i];
+      src->e[i] = src->e[--src->n];
+      moved = 1;
+    }
+    next = src->next;
+    if(moved)
+      log_write(sbp);
+    brelse(sbp);
+  }
+  log_write(dbp);
+  brelse(dbp);
+  ix->nbucket = n+1;
+  log_write(hbp);
+}
+
+// Add (h, slot) to the index in hbp, splitting buckets as
+// the index fills.  Returns -1 if h's chain is too long.
+static int
+ixinsert(struct inode *dp, struct buf *hbp, uint h, uint slot)
+{
+  struct dirindex *ix;
+  struct dirbucket *bk;
+  struct buf *bp;
+  uint b;
+  int len;
+
+  ix = (struct dirindex*)hbp->data;
+  b = ix->bucket[ixbucket(h, ix->nbucket)];
+  for(len = 1; ; len++){
+    bp = bread(dp->dev, b);
+    bk = (struct dirbucket*)bp->data;
+    if(bk->n < NDIRHENT)
+      break;
+    if(bk->next == 0){
+      if(len == IXMAXCHAIN){
+        brelse(bp);
+        return -1;
+      }
+      bk->next = balloc(dp->dev, 0);
+      log_write(bp);
+    }
+    b = bk->next;
+    brelse(bp);
+  }
+  bk->e[bk->n].hash = h;
+  bk->e[bk->n].slot = slot;
+  bk->n++;
+  log_write(bp);
+  brelse(bp);
+
+  ix->nentry++;
+  if(ix->nentry > ix->nbucket*NDIRHENT/2)
+    ixsplit(dp, hbp);  // keep buckets half full on average
+  log_write(hbp);
+  return 0;
+}
+
+// Remove (h, slot) from dp's index.
+static void
+ixremove(struct inode *dp, uint h, uint slot)
+{
+  struct dirindex *ix;
+  struct dirbucket *bk;
+  struct buf *hbp, *bp;
+  uint b, i;
+
+  hbp = bread(dp->dev, dp->index);
+  ix = (struct dirindex*)hbp->data;
+  for(b = ix->bucket[ixbucket(h, ix->nbucket)]; b != 0; ){
+    bp = bread(dp->dev, b);
+    bk = (struct dirbucket*)bp->data;
+    for(i = 0; i < bk->n; i++)
+      if(bk->e[i].slot == slot)
+        break;
+    if(i < bk->n)
+      break;
+    b = bk->next;
+    brelse(bp);
+  }
+  if(b == 0)
+    panic("ixremove");
+  bk->e[i] = bk->e[--bk->n];
+  log_write(bp);
+  brelse(bp);
+  ix->nentry--;
+  if(slot < ix->freeslot)
+    ix->freeslot = slot;
+  log_write(hbp);
+  brelse(hbp);
+}
+
+// Free dp's index, if it has one.
+// Caller must update dp on disk.
+static void
+ixdrop(struct inode *dp)
+{
+  struct dirindex *ix;
+  struct buf *hbp, *bp;
+  uint i, b, next;
+
+  if(!ixvalid(dp)){
+    dp->index = 0;
+    return;
+  }
+  hbp = bread(dp->dev, dp->index);
+  ix = (struct dirindex*)hbp->data;
+  for(i = 0; i < ix->nbucket; i++){
+    for(b = ix->bucket[i]; b != 0; b = next){
+      bp = bread(dp->dev, b);
+      next = ((struct dirbucket*)bp->data)->next;
+      brelse(bp);
+      bfree(dp->dev, b);
+    }
+  }
+  brelse(hbp);
+  bfree(dp->dev, dp->index);
+  dp->index = 0;
+}
+
+// Give up dp's index for good.
+static void
+ixgiveup(struct inode *dp)
+{
+  ixdrop(dp);
+  dp->index = DIRNOINDEX;
+  iupdate(dp);
+}
+
+// Give dp an index of its current entries, unless that
+// takes more than IXMAXBUILD buckets.
+static void
+ixbuild(struct inode *dp)
+{
+  struct dirindex *ix;
+  struct dirent de;
+  struct buf *hbp;
+  uint n, off, nslot;
+
+  nslot = dp->size / sizeof(de);
+  for(n = 1; n*NDIRHENT/2 < nslot; n++)
+    ;
+  if(n > IXMAXBUILD){
+    ixgiveup(dp);
+    return;
+  }
+
+  dp->index = balloc(dp->dev, 0);
+  hbp = bread(dp->dev, dp->index);
+  ix = (struct dirindex*)hbp->data;
+  for(ix->nbucket = 0; ix->nbucket < n; ix->nbucket++)
+    ix->bucket[ix->nbucket] = balloc(dp->dev, 0);
+  ix->freeslot = nslot;
+  for(off = 0; off < dp->size; off += sizeof(de)){
+    if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
+      panic("ixbuild read");
+    if(de.inum == 0){
+      if(off/sizeof(de) < ix->freeslot)
+        ix->freeslot = off/sizeof(de);
+      continue;
+    }
+    if(ixinsert(dp, hbp, ixhash(de.name), off/sizeof(de)) < 0){
+      brelse(hbp);
+      ixgiveup(dp);
+      return;
+    }
+  }
+  log_write(hbp);
+  brelse(hbp);
+  iupdate(dp);
+}
+
+// Look name up in dp's index.
+static struct inode*
+ixlookup(struct inode *dp, char *name, uint *poff)
+{
+  struct dirindex *ix;
+  struct dirbucket *bk;
+  struct dirent de;
+  struct buf *bp;
+  uint h, i, b, off;
+
+  h = ixhash(name);
+  bp = bread(dp->dev, dp->index);
+  ix = (struct dirindex*)bp->data;
+  b = ix->bucket[ixbucket(h, ix->nbucket)];
+  brelse(bp);
+
+  while(b != 0){
+    bp = bread(dp->dev, b);
+    bk = (struct dirbucket*)bp->data;
+    for(i = 0; i < bk->n; i++){
+      if(bk->e[i].hash != h)
+        continue;
+      off = bk->e[i].slot * sizeof(de);
+      if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
+        panic("ixlookup read");
+      if(de.inum != 0 && namecmp(name, de.name) == 0){
+        brelse(bp);
+        if(poff)
+          *poff = off;
+        return iget(dp->dev, de.inum);
+      }
+    }
+    b = bk->next;
+    brelse(bp);
+  }
+  return 0;
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 struct inode*
@@ -511,6 +1209,9 @@ dirlookup(struct inode *dp, char *name, uint *poff)
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
+  if(ixvalid(dp))
+    return ixlookup(dp, name, poff);
+
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
       panic("dirlink read");
@@ -535,6 +1236,8 @@ dirlink(struct inode *dp, char *name, uint inum)
   int off;
   struct dirent de;
   struct inode *ip;
+  struct buf *hbp;
+  struct dirindex *ix;
 
   // Check that name is not present.
   if((ip = dirlookup(dp, name, 0)) != 0){
@@ -542,8 +1245,17 @@ dirlink(struct inode *dp, char *name, uint inum)
     return -1;
   }
 
-  // Look for an empty dirent.
-  for(off = 0; off < dp->size; off += sizeof(de)){
+  // Look for an empty dirent, starting where
+  // the index says the first one may be.
+  hbp = 0;
+  ix = 0;
+  off = 0;
+  if(ixvalid(dp)){
+    hbp = bread(dp->dev, dp->index);
+    ix = (struct dirindex*)hbp->data;
+    off = ix->freeslot * sizeof(de);
+  }
+  for(; off < dp->size; off += sizeof(de)){
     if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
       panic("dirlink read");
     if(de.inum == 0)
@@ -555,9 +1267,34 @@ dirlink(struct inode *dp, char *name, uint inum)
   if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
     panic("dirlink");
 
+  if(hbp){
+    ix->freeslot = off/sizeof(de) + 1;
+    if(ixinsert(dp, hbp, ixhash(name), off/sizeof(de)) < 0){
+      brelse(hbp);
+      ixgiveup(dp);
+    } else
+      brelse(hbp);
+  } else if(dp->index == 0 && dp->size > BSIZE)
+    ixbuild(dp);
+
   return 0;
 }
 
+// Remove the directory entry at byte offset off in dp.
+void
+dirunlink(struct inode *dp, uint off)
+{
+  struct dirent de;
+
+  if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
+    panic("dirunlink read");
+  if(ixvalid(dp))
+    ixremove(dp, ixhash(de.name), off/sizeof(de));
+  memset(&de, 0, sizeof(de));
+  if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
+    panic("unlink: writei");
+}
+
 //PAGEBREAK!
 // Paths
 
@@ -612,7 +1349,7 @@ namex(char *path, int nameiparent, char *name)
     ip = idup(proc->cwd);
 
   while((path = skipelem(path, name)) != 0){
-    ilock(ip);
+    ilockshared(ip);
     if(ip->type != T_DIR){
       iunlockput(ip);
       return 0;
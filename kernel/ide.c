@@ -1,4 +1,6 @@
-// Simple PIO-based (non-DMA) IDE driver code.
+// Simple IDE driver code.  Uses bus-master DMA when the
+// controller is a PCI bus-master IDE (such as the PIIX that
+// QEMU emulates), and PIO otherwise.
 
 #include "types.h"
 #include "defs.h"
@@ -9,7 +11,11 @@
 #include "x86.h"
 #include "traps.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "buf.h"
+#include "fs.h"
+#include "pci.h"
+#include "iosched.h"
 
 #define IDE_BSY       0x80
 #define IDE_DRDY      0x40
@@ -18,16 +24,69 @@
 
 #define IDE_CMD_READ  0x20
 #define IDE_CMD_WRITE 0x30
+#define IDE_CMD_RDMUL 0xc4
+#define IDE_CMD_WRMUL 0xc5
+#define IDE_CMD_SETMUL 0xc6
+#define IDE_CMD_RDDMA 0xc8
+#define IDE_CMD_WRDMA 0xca
 
-// idequeue points to the buf now being read/written to the disk.
-// idequeue->qnext points to the next buf to be processed.
-// You must hold idelock while manipulating queue.
+// Bus-master registers, at idebm, for the primary channel.
+#define BM_CMD        0x0
+#define BM_STATUS     0x2
+#define BM_PRDT       0x4
+#define BM_CMD_START  0x01
+#define BM_CMD_READ   0x08  // device to memory
+#define BM_ST_ERR     0x02
+#define BM_ST_INTR    0x04
+
+#define IDEMULT    8  // sectors per interrupt in PIO multiple mode
+#define IDEMAXRUN 32  // most bufs per command with DMA
+
+// A buf holds a block of BSECT sectors.  A command moves at
+// most 256 sectors, and a PIO multiple interrupt IDEMULT.
+#if IDEMAXRUN*BSECT > 256 || BSECT > IDEMULT
+#error "ide.c: BSIZE too large"
+#endif
+
+// Requests wait in ideq, in the order its I/O scheduler
+// picks.  When the disk is idle, idestart takes the next
+// request, and queued requests for the following blocks
+// in the same direction, and does them as one command.
+// idequeue points to the first buf of that command, and
+// idequeue->qnext to the next, for idenrun bufs.
+// You must hold idelock while manipulating either queue.
 
 static struct spinlock idelock;
+static struct ioqueue ideq;
 static struct buf *idequeue;
+static int idenrun;
+
+int ideirq = IRQ_IDE;
 
 static int havedisk1;
-static void idestart(struct buf*);
+static int idemaxrun[2];  // most bufs per command, per disk
+static void idestart(void);
+
+// Physical region descriptor: one DMA transfer.
+// The table must not cross a 64 KB boundary.
+struct prd {
+  uint addr;
+  ushort len;
+  ushort flags;
+};
+#define PRD_EOT 0x8000  // last entry in the table
+
+static ushort idebm;    // bus-master I/O base, 0 if PIO only
+static struct prd prdt[IDEMAXRUN] __attribute__((aligned(sizeof(struct prd)*IDEMAXRUN)));
+
+// Statistics, protected by idelock.
+static struct {
+  uint64 requests;  // bufs transferred
+  uint64 commands;  // disk commands issued
+  uint64 merged;    // requests done by another's command
+  uint64 intrs;     // interrupts handled
+  uint64 intrtsc;   // cycles spent in ideintr
+} idestat;
 
 // Wait for IDE disk to become ready.
 static int
@@ -45,9 +104,11 @@ idewait(int checkerr)
 void
 ideinit(void)
 {
+  struct pcidev pci;
   int i;
 
   initlock(&idelock, "ide");
+  ioqinit(&ideq, IOSCHED);
   picenable(IRQ_IDE);
   ioapicenable(IRQ_IDE, ncpu - 1);
   idewait(0);
@@ -61,29 +122,89 @@ ideinit(void)
     }
   }
 
+  // Use DMA if the controller can master the bus;
+  // otherwise let each disk move IDEMULT sectors per
+  // PIO interrupt, which blocks larger than a sector need.
+  if(pcifind(0, 0, 0x01, 0x01, &pci) == 0 && (pci.bar[4] & PCI_BAR_IO)){
+    pcienable(&pci);
+    idebm = pci.bar[4] & ~3;
+  }
+  for(i = 0; i < 1+havedisk1; i++){
+    idemaxrun[i] = 1;
+    if(idebm){
+      idemaxrun[i] = IDEMAXRUN;
+      continue;
+    }
+    outb(0x1f6, 0xe0 | (i<<4));
+    outb(0x1f2, IDEMULT);
+    outb(0x1f7, IDE_CMD_SETMUL);
+    if(idewait(1) >= 0)
+      idemaxrun[i] = IDEMULT / BSECT;
+    else if(BSECT > 1)
+      panic("ide: no DMA or PIO multiple mode");
+  }
+
   // Switch back to disk 0.
   outb(0x1f6, 0xe0 | (0<<4));
 }
 
-// Start the request for b.  Caller must hold idelock.
+// Start the next queued request, and any that merge with it.
+// Caller must hold idelock, and the disk must be idle.
 static void
-idestart(struct buf *b)
+idestart(void)
 {
-  if(b == 0)
+  struct buf *b, *q, *last;
+  uint sector;
+  int i;
+
+  if(idequeue != 0 || (b = ioqnext(&ideq)) == 0)
     panic("idestart");
 
+  idequeue = last = b;
+  idenrun = 1;
+  while(idenrun < idemaxrun[b->dev&1] && (q = ioqmerge(&ideq, last)) != 0){
+    last->qnext = q;
+    last = q;
+    idenrun++;
+  }
+  last->qnext = 0;
+  idestat.commands++;
+  idestat.requests += idenrun;
+  idestat.merged += idenrun - 1;
+
+  if(idebm){
+    // Point the controller at the run's buffers.
+    // A PRD region must not cross a 64 KB boundary.
+    for(i = 0, q = b; i < idenrun; i++, q = q->qnext){
+      if((v2p(q->data) ^ (v2p(q->data) + BSIZE - 1)) >> 16)
+        panic("idestart: buf crosses 64 KB boundary");
+      prdt[i].addr = v2p(q->data);
+      prdt[i].len = BSIZE;
+      prdt[i].flags = 0;
+    }
+    prdt[idenrun-1].flags = PRD_EOT;
+    outl(idebm+BM_PRDT, v2p(prdt));
+    outb(idebm+BM_CMD, (b->flags & B_DIRTY) ? 0 : BM_CMD_READ);
+    outb(idebm+BM_STATUS, inb(idebm+BM_STATUS) | BM_ST_ERR | BM_ST_INTR);
+  }
+
   idewait(0);
   outb(0x3f6, 0);  // generate interrupt
-  outb(0x1f2, 1);  // number of sectors
-  outb(0x1f3, b->sector & 0xff);
-  outb(0x1f4, (b->sector >> 8) & 0xff);
-  outb(0x1f5, (b->sector >> 16) & 0xff);
-  outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((b->sector>>24)&0x0f));
-  if(b->flags & B_DIRTY){
-    outb(0x1f7, IDE_CMD_WRITE);
-    outsl(0x1f0, b->data, 512/4);
+  sector = b->sector * BSECT;
+  outb(0x1f2, idenrun * BSECT);  // number of sectors; 0 means 256
+  outb(0x1f3, sector & 0xff);
+  outb(0x1f4, (sector >> 8) & 0xff);
+  outb(0x1f5, (sector >> 16) & 0xff);
+  outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((sector>>24)&0x0f));
+  if(idebm){
+    outb(0x1f7, (b->flags & B_DIRTY) ? IDE_CMD_WRDMA : IDE_CMD_RDDMA);
+    outb(idebm+BM_CMD, inb(idebm+BM_CMD) | BM_CMD_START);
+  } else if(b->flags & B_DIRTY){
+    outb(0x1f7, idenrun*BSECT > 1 ? IDE_CMD_WRMUL : IDE_CMD_WRITE);
+    for(i = 0, q = b; i < idenrun; i++, q = q->qnext)
+      outsl(0x1f0, q->data, BSIZE/4);
   } else {
-    outb(0x1f7, IDE_CMD_READ);
+    outb(0x1f7, idenrun*BSECT > 1 ? IDE_CMD_RDMUL : IDE_CMD_READ);
   }
 }
 
@@ -91,60 +212,146 @@ idestart(struct buf *b)
 void
 ideintr(void)
 {
-  struct buf *b;
+  struct buf *b, *run[IDEMAXRUN];
+  void (*done[IDEMAXRUN])(struct buf*);
+  int i, n, pio, st;
+  uint64 t0;
 
-  // First queued buffer is the active request.
+  t0 = rdtsc();
+
+  // The first idenrun queued buffers are the active request.
   acquire(&idelock);
-  if((b = idequeue) == 0){
+  if(idequeue == 0){
     release(&idelock);
     // cprintf("spurious IDE interrupt\n");
     return;
   }
-  idequeue = b->qnext;
+  n = idenrun;
+  for(i = 0; i < n; i++){
+    run[i] = idequeue;
+    idequeue = idequeue->qnext;
+  }
+  if(idequeue != 0)
+    panic("ideintr");
 
-  // Read data if needed.
-  if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
-    insl(0x1f0, b->data, 512/4);
+  // With DMA the data is already in memory: stop the engine,
+  // check the bus-master and drive status for errors, and
+  // clear the bus-master bits to acknowledge the interrupt.
+  // Otherwise read data if needed.
+  pio = 1;
+  if(idebm){
+    st = inb(idebm+BM_STATUS);
+    outb(idebm+BM_CMD, inb(idebm+BM_CMD) & ~BM_CMD_START);
+    outb(idebm+BM_STATUS, st | BM_ST_ERR | BM_ST_INTR);
+    if((st & BM_ST_ERR) || idewait(1) < 0)
+      panic("ide: DMA error");
+    pio = 0;
+  }
+  for(i = 0; i < n; i++){
+    b = run[i];
+    if(!(b->flags & B_DIRTY) && pio && (pio = idewait(1) >= 0))
+      insl(0x1f0, b->data, BSIZE/4);
 
-  // Wake process waiting for this buf.
-  b->flags |= B_VALID;
-  b->flags &= ~B_DIRTY;
-  wakeup(b);
+    // Wake process waiting for this buf.
+    done[i] = b->iodone;
+    b->flags |= B_VALID;
+    b->flags &= ~B_DIRTY;
+    ioqdone(&ideq, b);
+    wakeup(b);
+  }
 
-  // Start disk on next buf in queue.
-  if(idequeue != 0)
-    idestart(idequeue);
+  // Start disk on next request, and wake any
+  // process waiting for space in the queue.
+  if(ideq.n > 0)
+    idestart();
+  wakeup(&ideq);
 
+  idestat.intrs++;
+  idestat.intrtsc += rdtsc() - t0;
   release(&idelock);
+
+  // Run completion callbacks, if any, without idelock.
+  for(i = 0; i < n; i++)
+    if(done[i])
+      done[i](run[i]);
 }
 
-//PAGEBREAK!
-// Sync buf with disk.
-// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
-// Else if B_VALID is not set, read buf from disk, set B_VALID.
+// Print disk request statistics.
+// Runs when user types ^B on console.
 void
-iderw(struct buf *b)
+idedump(void)
 {
-  struct buf **pp;
+  uint64 avg;
+
+  avg = idestat.commands ? idestat.requests*BSIZE / idestat.commands : 0;
+  cprintf("ide (%s): %l requests %l commands %l merged, %l bytes per command\n",
+          idebm ? "dma" : "pio", idestat.requests, idestat.commands,
+          idestat.merged, avg);
+  cprintf("ide: %l interrupts, %l cycles in ideintr\n",
+          idestat.intrs, idestat.intrtsc);
+  ioqdump(&ideq);
+}
 
-  if(!(b->flags & B_BUSY))
-    panic("iderw: buf not busy");
+//PAGEBREAK!
+// Add b to ideq, waiting if it is full.
+// Caller must hold idelock.
+static void
+idequeueb(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("iderw: buf not locked");
   if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
     panic("iderw: nothing to do");
   if(b->dev != 0 && !havedisk1)
     panic("iderw: ide disk 1 not present");
 
-  acquire(&idelock);  //DOC:acquire-lock
+  while(ioqfull(&ideq)){
+    if(idequeue == 0)
+      idestart();
+    sleep(&ideq, &idelock);
+  }
+  ioqadd(&ideq, b);
+}
 
-  // Append b to idequeue.
-  b->qnext = 0;
-  for(pp=&idequeue; *pp; pp=&(*pp)->qnext)  //DOC:insert-queue
-    ;
-  *pp = b;
+// Start syncing n bufs with disk and return at once.
+// Wait for each with ideawait, unless it has an iodone
+// callback, which ideintr calls when it is done instead.
+// Queueing them all before starting the disk lets
+// neighbouring requests in the batch merge.
+void
+idesubmit(struct buf **bs, int n)
+{
+  int i;
+
+  acquire(&idelock);
+  for(i = 0; i < n; i++)
+    idequeueb(bs[i]);
+  if(idequeue == 0)
+    idestart();
+  release(&idelock);
+}
 
-  // Start disk if necessary.
-  if(idequeue == b)
-    idestart(b);
+// Wait for the request for b to finish.
+void
+ideawait(struct buf *b)
+{
+  acquire(&idelock);
+  while((b->flags & (B_VALID|B_DIRTY)) != B_VALID){
+    sleep(b, &idelock);
+  }
+  release(&idelock);
+}
+
+// Sync buf with disk.
+// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
+// Else if B_VALID is not set, read buf from disk, set B_VALID.
+void
+iderw(struct buf *b)
+{
+  acquire(&idelock);  //DOC:acquire-lock
+  idequeueb(b);
+  if(idequeue == 0)
+    idestart();
 
   // Wait for request to finish.
   while((b->flags & (B_VALID|B_DIRTY)) != B_VALID){
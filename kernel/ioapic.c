@@ -80,3 +80,16 @@ ioapicenable(int irq, int cpunum)
   ioapicwrite(REG_TABLE+2*irq, T_IRQ0 + irq);
   ioapicwrite(REG_TABLE+2*irq+1, cpunum << 24);
 }
+
+// Like ioapicenable, for a PCI interrupt line, which is
+// level-triggered and active low.  The handler must make
+// the device lower the line before sending the EOI.
+void
+ioapicenablepci(int irq, int cpunum)
+{
+  if(!ismp)
+    return;
+
+  ioapicwrite(REG_TABLE+2*irq, INT_LEVEL | INT_ACTIVELOW | (T_IRQ0 + irq));
+  ioapicwrite(REG_TABLE+2*irq+1, cpunum << 24);
+}
@@ -0,0 +1,272 @@
+// I/O schedulers for disk request queues.
+//
+// Every scheduler keeps requests in the two C-LOOK heaps, so
+// both insertion and removal are O(log n), and a merge only
+// needs to look at the top of a heap.  The policies are:
+// * clook: serve requests in ascending sector order, and
+//     start over at the lowest sector when none are left
+//     beyond the last one served.
+// * deadline: clook, but first serve any read or write that
+//     has waited longer than its expiry, oldest first.
+//
+// IOSCHED in param.h names the scheduler disks start with.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "x86.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "buf.h"
+#include "iosched.h"
+
+#define READ_EXPIRE   5  // ticks a read may wait under deadline
+#define WRITE_EXPIRE 50  // ticks a write may wait under deadline
+
+static struct buf *clooknext(struct ioqueue*);
+static struct buf *deadlinenext(struct ioqueue*);
+
+static struct iosched scheds[] = {
+  { "clook",    clooknext },
+  { "deadline", deadlinenext },
+};
+
+// Sort key for b: sectors in order, disk by disk.
+static uint64
+key(struct buf *b)
+{
+  return ((uint64)b->dev << 32) | b->sector;
+}
+
+static int
+dir(struct buf *b)
+{
+  return (b->flags & B_DIRTY) != 0;
+}
+
+static int
+hist(uint64 v)
+{
+  int i;
+
+  for(i = 0; v > 0 && i < NIOHIST-1; i++)
+    v >>= 1;
+  return i;
+}
+
+//PAGEBREAK!
+// Binary min-heaps of bufs by key.  Each buf records
+// its heap and position in qheap and qidx.
+
+static void
+heapset(struct ioqueue *q, int h, int i, struct buf *b)
+{
+  q->heap[h][i] = b;
+  b->qheap = h;
+  b->qidx = i;
+}
+
+static void
+heapup(struct ioqueue *q, int h, int i)
+{
+  struct buf *b;
+
+  b = q->heap[h][i];
+  while(i > 0 && key(q->heap[h][(i-1)/2]) > key(b)){
+    heapset(q, h, i, q->heap[h][(i-1)/2]);
+    i = (i-1)/2;
+  }
+  heapset(q, h, i, b);
+}
+
+static void
+heapdown(struct ioqueue *q, int h, int i)
+{
+  struct buf *b;
+  int c, n;
+
+  n = q->nheap[h];
+  b = q->heap[h][i];
+  for(;;){
+    c = 2*i + 1;
+    if(c >= n)
+      break;
+    if(c+1 < n && key(q->heap[h][c+1]) < key(q->heap[h][c]))
+      c++;
+    if(key(q->heap[h][c]) >= key(b))
+      break;
+    heapset(q, h, i, q->heap[h][c]);
+    i = c;
+  }
+  heapset(q, h, i, b);
+}
+
+// Remove b from the queue: its heap, and its FIFO if any.
+static void
+ioqremove(struct ioqueue *q, struct buf *b)
+{
+  int h, i, d;
+
+  h = b->qheap;
+  i = b->qidx;
+  if(i >= q->nheap[h] || q->heap[h][i] != b)
+    panic("ioqremove");
+  q->nheap[h]--;
+  if(i < q->nheap[h]){
+    heapset(q, h, i, q->heap[h][q->nheap[h]]);
+    heapdown(q, h, i);
+    heapup(q, h, i);
+  }
+
+  d = dir(b);
+  if(b->qprev)
+    b->qprev->qnext = b->qnext;
+  else if(q->fifo[d] == b)
+    q->fifo[d] = b->qnext;
+  if(b->qnext)
+    b->qnext->qprev = b->qprev;
+  else if(q->fifotail[d] == b)
+    q->fifotail[d] = b->qprev;
+  b->qnext = b->qprev = 0;
+
+  q->n--;
+  q->pos = key(b) + 1;
+}
+
+//PAGEBREAK!
+void
+ioqinit(struct ioqueue *q, char *name)
+{
+  int i;
+
+  memset(q, 0, sizeof(*q));
+  q->sched = &scheds[0];
+  for(i = 0; i < NELEM(scheds); i++)
+    if(strncmp(scheds[i].name, name, 16) == 0)
+      q->sched = &scheds[i];
+}
+
+// Is q full?  Callers of ioqadd must wait until it is not.
+int
+ioqfull(struct ioqueue *q)
+{
+  return q->n == NIOQ;
+}
+
+// Queue request b.
+void
+ioqadd(struct ioqueue *q, struct buf *b)
+{
+  int h, d;
+
+  if(ioqfull(q))
+    panic("ioqadd");
+  q->depth[hist(q->n)]++;
+  b->qtime = ticks;
+  b->qtsc = rdtsc();
+
+  // Sectors before pos wait for the next sweep.
+  h = key(b) >= q->pos ? q->cur : !q->cur;
+  q->heap[h][q->nheap[h]] = b;
+  heapup(q, h, q->nheap[h]++);
+
+  d = dir(b);
+  b->qnext = 0;
+  b->qprev = q->fifotail[d];
+  if(q->fifotail[d])
+    q->fifotail[d]->qnext = b;
+  else
+    q->fifo[d] = b;
+  q->fifotail[d] = b;
+  q->n++;
+}
+
+// Remove and return the request to start next, or 0.
+struct buf*
+ioqnext(struct ioqueue *q)
+{
+  if(q->n == 0)
+    return 0;
+  return q->sched->next(q);
+}
+
+// Remove and return a queued request for the sector after
+// last's in the same direction, to join last's command;
+// or 0 if there is none.  Only heap tops can qualify.
+struct buf*
+ioqmerge(struct ioqueue *q, struct buf *last)
+{
+  struct buf *b;
+  int h;
+
+  for(h = 0; h < 2; h++){
+    if(q->nheap[h] == 0)
+      continue;
+    b = q->heap[h][0];
+    if(key(b) == key(last) + 1 && dir(b) == dir(last)){
+      ioqremove(q, b);
+      return b;
+    }
+  }
+  return 0;
+}
+
+// Record that request b has completed.
+void
+ioqdone(struct ioqueue *q, struct buf *b)
+{
+  q->latency[hist((rdtsc() - b->qtsc) >> 10)]++;
+}
+
+//PAGEBREAK!
+static struct buf*
+clooknext(struct ioqueue *q)
+{
+  struct buf *b;
+
+  if(q->nheap[q->cur] == 0)
+    q->cur = !q->cur;  // start the next sweep
+  b = q->heap[q->cur][0];
+  ioqremove(q, b);
+  return b;
+}
+
+static struct buf*
+deadlinenext(struct ioqueue *q)
+{
+  struct buf *b, *r, *w;
+
+  // Oldest expired request first, reads before writes.
+  r = q->fifo[0];
+  w = q->fifo[1];
+  if(r && ticks - r->qtime >= READ_EXPIRE)
+    b = r;
+  else if(w && ticks - w->qtime >= WRITE_EXPIRE)
+    b = w;
+  else
+    return clooknext(q);
+  ioqremove(q, b);
+  return b;
+}
+
+static void
+histdump(char *name, uint64 *h)
+{
+  int i;
+
+  cprintf("  %s:", name);
+  for(i = 0; i < NIOHIST; i++)
+    if(h[i])
+      cprintf(" <%d:%l", 1<<i, h[i]);
+  cprintf("\n");
+}
+
+// Print q's scheduler and histograms.  Each histogram
+// entry is a power-of-two bucket's upper bound: count.
+void
+ioqdump(struct ioqueue *q)
+{
+  cprintf("iosched %s: %d queued\n", q->sched->name, q->n);
+  histdump("depth", q->depth);
+  histdump("latency (kcycles)", q->latency);
+}
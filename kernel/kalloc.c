@@ -22,6 +22,7 @@ struct {
   struct spinlock lock;
   int use_lock;
   struct run *freelist;
+  int nfree;
 } kmem;
 
 // Initialization happens in two phases.
@@ -78,6 +79,7 @@ kfree(char *v)
   r = (struct run*)v;
   r->next = kmem.freelist;
   kmem.freelist = r;
+  kmem.nfree++;
   if(kmem.use_lock)
     release(&kmem.lock);
 }
@@ -85,6 +87,9 @@ kfree(char *v)
 // Allocate one 4096-byte page of physical memory.
 // Returns a pointer that the kernel can use.
 // Returns 0 if the memory cannot be allocated.
+// When the free list is empty, takes a page back
+// from the buffer or page cache; callers must not
+// hold their locks.
 char*
 kalloc(void)
 {
@@ -93,9 +98,23 @@ kalloc(void)
   if(kmem.use_lock)
     acquire(&kmem.lock);
   r = kmem.freelist;
-  if(r)
+  if(r){
     kmem.freelist = r->next;
+    kmem.nfree--;
+  }
   if(kmem.use_lock)
     release(&kmem.lock);
+  if(r == 0 && kmem.use_lock){
+    if((r = (struct run*)breclaim()) == 0)
+      r = (struct run*)preclaim();
+  }
   return (char*)r;
 }
+
+// Return the number of free pages.
+// No lock; the count is only a hint.
+int
+kfreepages(void)
+{
+  return kmem.nfree;
+}
@@ -2,21 +2,25 @@
 #include "defs.h"
 #include "param.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
 
 // Simple logging. Each system call that might write the file system
 // should be surrounded with begin_trans() and commit_trans() calls.
 //
-// The log holds at most one transaction at a time. Commit forces
-// the log (with commit record) to disk, then installs the affected
-// blocks to disk, then erases the log. begin_trans() ensures that
-// only one system call can be in a transaction; others must wait.
+// A log transaction contains the updates of multiple system calls.
+// The logging system only commits when there are no file system
+// system calls active, so it never commits the partial updates of
+// a call that is still running.  Commit forces the log (with
+// commit record) to disk; later the checkpoint thread installs
+// the affected blocks to disk, then erases the log.
 //
-// Allowing only one transaction at a time means that the file
-// system code doesn't have to worry about the possibility of
-// one transaction reading a block that another one has modified,
-// for example an i-node block.
+// begin_trans() reserves room for MAXOPBLOCKS blocks, and waits
+// while a commit is in progress or the log could not hold the
+// blocks of every call already admitted plus this one.  The last
+// commit_trans() of a group commits for all of them, so parallel
+// writers share one commit instead of queueing behind each other.
 //
 // Read-only system calls don't need to use transactions, though
 // this means that they may observe uncommitted data. I-node and
@@ -24,15 +28,34 @@
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
-//   header block, containing sector #s for block A, B, C, ...
+//   header blocks, containing the count and sector #s for
+//     block A, B, C, ...; as many as the log size needs
 //   block A
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// In write-back mode (WRITEBACK), file data is not logged: it
+// stays dirty in the cache and commit writes it home before the
+// log, so metadata never refers to data that is not on disk
+// (ordered mode).  A commit then happens only when the log is
+// nearly full, every FLUSHTICKS ticks from the flusher thread,
+// or when log_sync() asks, as fsync and sync do.
+//
+// Logged blocks stay pinned in the buffer cache until commit
+// writes them to the log.  Once the header is on disk the
+// committing calls return, and a kernel thread checkpoints the
+// transaction: it writes the blocks home, erases the log, and
+// unpins them.  Meanwhile the pinned buffers serve reads of the
+// home locations, and the next transaction gathers in memory;
+// only its commit must wait for the checkpoint, since it reuses
+// the log blocks.
+
+#define LOGBATCH 16  // log or home blocks written at once
+#define HPB (BSIZE / sizeof(int))  // header words per block
 
-// Contents of the header block, used for both the on-disk header block
-// and to keep track in memory of logged sector #s before commit.
+// Contents of the header, used to keep track in memory of logged
+// sector #s before commit.  On disk it is the same words laid out
+// across the header blocks, the count first.
 struct logheader {
   int n;
   int sector[LOGSIZE];
@@ -42,42 +65,185 @@ struct log {
   struct spinlock lock;
   int start;
   int size;
-  int busy; // a transaction is active
+  int nhead;       // header blocks
+  int ndata;       // most data blocks in a transaction
+  int outstanding; // how many system calls are executing
+  int committing;  // in commit(), please wait
   int dev;
-  struct logheader lh;
+  int force;       // commit when the last call finishes
+  uint ncommit;    // commits finished
+  struct logheader lh;          // transaction being built
+  struct buf *home[LOGSIZE];    // its pinned buffers
+  struct buf *copy[LOGSIZE];    // its pinned log copies, once written
+  struct logheader ck;          // committed, not yet checkpointed
+  struct buf *ckhome[LOGSIZE];
+  struct buf *ckcopy[LOGSIZE];
 };
 struct log log;
 
+// Bufs outside the cache through which checkpoint writes
+// blocks home.  Used only by the checkpoint thread.
+// Aligned so that no block crosses a 64 KB DMA boundary.
+static struct buf ckbuf[LOGBATCH];
+static uchar ckdata[LOGBATCH][BSIZE] __attribute__((aligned(BSIZE)));
+
 static void recover_from_log(void);
+static void checkpointer(void);
+static void flusher(void);
 
 void
 initlog(void)
 {
-  if (sizeof(struct logheader) >= BSIZE)
-    panic("initlog: too big logheader");
-
   struct superblock sb;
+  int i;
+
   initlock(&log.lock, "log");
+  for (i = 0; i < LOGBATCH; i++) {
+    initsleeplock(&ckbuf[i].lock, "ckbuf");
+    ckbuf[i].data = ckdata[i];
+  }
   readsb(ROOTDEV, &sb);
   log.start = sb.size - sb.nlog;
   log.size = sb.nlog;
   log.dev = ROOTDEV;
+
+  // The header needs a word for the count and one for
+  // each data block; the rest of the log holds data.
+  for (log.nhead = 1; log.size - log.nhead + 1 > log.nhead*HPB; log.nhead++)
+    ;
+  log.ndata = log.size - log.nhead;
+  if (log.ndata > LOGSIZE)
+    log.ndata = LOGSIZE;
+  if (log.ndata < MAXOPBLOCKS)
+    panic("initlog: log too small");
+
   recover_from_log();
+  if (kthread("checkpoint", checkpointer) < 0)
+    panic("initlog: checkpoint thread");
+  if (WRITEBACK && kthread("flusher", flusher) < 0)
+    panic("initlog: flusher thread");
 }
 
-// Copy committed blocks from log to their home location
+// Copy committed blocks from log to their home location,
+// LOGBATCH at a time: start all the reads, copy, then start
+// all the writes, so the disk queue stays full.  Used by
+// recovery, when the cache holds none of the blocks.
 static void
-install_trans(void)
+recover_trans(void)
 {
-  int tail;
+  struct buf *lbuf[LOGBATCH], *dbuf[LOGBATCH];
+  uint lsec[LOGBATCH];
+  int tail, i, n;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.sector[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    brelse(lbuf);
-    brelse(dbuf);
+  for (tail = 0; tail < log.lh.n; tail += n) {
+    n = log.lh.n - tail < LOGBATCH ? log.lh.n - tail : LOGBATCH;
+    for (i = 0; i < n; i++)
+      lsec[i] = log.start+log.nhead+tail+i;
+    breadn(log.dev, lsec, n, lbuf); // read log blocks
+    breadn(log.dev, (uint*)&log.lh.sector[tail], n, dbuf); // read dst
+    for (i = 0; i < n; i++) {
+      bwait(lbuf[i]);
+      bwait(dbuf[i]);
+      memmove(dbuf[i]->data, lbuf[i]->data, BSIZE);  // copy block to dst
+      brelse(lbuf[i]);
+    }
+    bwriten(dbuf, n);  // write dst to disk
+    for (i = 0; i < n; i++) {
+      bwait(dbuf[i]);
+      brelse(dbuf[i]);
+    }
+  }
+}
+
+// Copy the modified blocks from the cache to the log,
+// LOGBATCH at a time.  The log copies are overwritten in
+// full, so they are never read from disk.  They stay pinned
+// for checkpoint.
+static void
+write_log(void)
+{
+  struct buf *lbuf[LOGBATCH], *from;
+  int tail, i, n;
+
+  for (tail = 0; tail < log.lh.n; tail += n) {
+    n = log.lh.n - tail < LOGBATCH ? log.lh.n - tail : LOGBATCH;
+    for (i = 0; i < n; i++) {
+      lbuf[i] = bfresh(log.dev, log.start+log.nhead+tail+i);
+      from = bread(log.dev, log.lh.sector[tail+i]); // cache block
+      memmove(lbuf[i]->data, from->data, BSIZE);
+      brelse(from);
+    }
+    bwriten(lbuf, n);  // write the log
+    for (i = 0; i < n; i++) {
+      bwait(lbuf[i]);
+      bpin(lbuf[i]);
+      log.copy[tail+i] = lbuf[i];
+      brelse(lbuf[i]);
+    }
+  }
+}
+
+// Write the blocks of committed transaction log.ck home,
+// LOGBATCH at a time, then erase it from the log and unpin
+// its buffers.  The home buffers in the cache may already
+// hold changes of the next, uncommitted transaction, so the
+// blocks are written from their log copies instead, through
+// bufs that are not in the cache.  Nothing else uses the
+// log copies until the next commit, which waits for this.
+static void
+checkpoint(void)
+{
+  struct buf *bs[LOGBATCH];
+  int tail, i, n;
+
+  for (tail = 0; tail < log.ck.n; tail += n) {
+    n = log.ck.n - tail < LOGBATCH ? log.ck.n - tail : LOGBATCH;
+    for (i = 0; i < n; i++) {
+      bs[i] = &ckbuf[i];
+      acquiresleep(&bs[i]->lock);
+      bs[i]->dev = log.dev;
+      bs[i]->sector = log.ck.sector[tail+i];
+      bs[i]->flags = B_VALID;
+      bs[i]->iodone = 0;
+      memmove(bs[i]->data, log.ckcopy[tail+i]->data, BSIZE);
+    }
+    bwriten(bs, n);  // write home
+    for (i = 0; i < n; i++) {
+      bwait(bs[i]);
+      releasesleep(&bs[i]->lock);
+    }
+  }
+
+  // Erase the transaction: a zeroed first header
+  // block has a count of 0.
+  bs[0] = &ckbuf[0];
+  acquiresleep(&bs[0]->lock);
+  bs[0]->sector = log.start;
+  bs[0]->flags = B_VALID;
+  memset(bs[0]->data, 0, BSIZE);
+  bwriten(bs, 1);
+  bwait(bs[0]);
+  releasesleep(&bs[0]->lock);
+
+  for (i = 0; i < log.ck.n; i++) {
+    bunpin(log.ckhome[i]);
+    bunpin(log.ckcopy[i]);
+  }
+}
+
+// Body of the checkpoint thread.
+static void
+checkpointer(void)
+{
+  acquire(&log.lock);
+  for (;;) {
+    while (log.ck.n == 0)
+      sleep(&log.ck, &log.lock);
+    release(&log.lock);
+    checkpoint();
+    acquire(&log.lock);
+    log.ck.n = 0;
+    wakeup(&log);
   }
 }
 
@@ -86,28 +252,63 @@ static void
 read_head(void)
 {
   struct buf *buf = bread(log.dev, log.start);
-  struct logheader *lh = (struct logheader *) (buf->data);
+  int *hw = (int *) (buf->data);
   int i;
-  log.lh.n = lh->n;
+  log.lh.n = hw[0];
+  if (log.lh.n < 0 || log.lh.n > log.ndata)
+    panic("read_head: bad log header");
   for (i = 0; i < log.lh.n; i++) {
-    log.lh.sector[i] = lh->sector[i];
+    if ((i+1) % HPB == 0) {  // continue in next header block
+      brelse(buf);
+      buf = bread(log.dev, log.start + (i+1)/HPB);
+      hw = (int *) (buf->data);
+    }
+    log.lh.sector[i] = hw[(i+1) % HPB];
   }
   brelse(buf);
 }
 
-// Write in-memory log header to disk.
-// This is the true point at which the
+// Fill buf with header block b of the in-memory log header.
+static void
+fill_head(struct buf *buf, int b)
+{
+  int *hw = (int *) (buf->data);
+  int i, w;
+  memset(hw, 0, BSIZE);
+  for (i = 0; i < HPB; i++) {
+    w = b*HPB + i;  // word 0 is the count
+    if (w == 0)
+      hw[i] = log.lh.n;
+    else if (w <= log.lh.n)
+      hw[i] = log.lh.sector[w-1];
+  }
+}
+
+// Write in-memory log header to disk.  The header blocks
+// after the first go out first; then the first block, with
+// the count.  Its write is the true point at which the
 // current transaction commits.
 static void
 write_head(void)
 {
-  struct buf *buf = bread(log.dev, log.start);
-  struct logheader *hb = (struct logheader *) (buf->data);
-  int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->sector[i] = log.lh.sector[i];
+  struct buf *bs[LOGBATCH], *buf;
+  int nb, b, i, m;
+
+  nb = (log.lh.n + HPB) / HPB;  // header blocks in use
+  for (b = 1; b < nb; b += m) {
+    m = nb - b < LOGBATCH ? nb - b : LOGBATCH;
+    for (i = 0; i < m; i++) {
+      bs[i] = bfresh(log.dev, log.start + b + i);
+      fill_head(bs[i], b + i);
+    }
+    bwriten(bs, m);
+    for (i = 0; i < m; i++) {
+      bwait(bs[i]);
+      brelse(bs[i]);
+    }
   }
+  buf = bfresh(log.dev, log.start);
+  fill_head(buf, 0);
   bwrite(buf);
   brelse(buf);
 }
@@ -116,41 +317,138 @@ static void
 recover_from_log(void)
 {
   read_head();
-  install_trans(); // if committed, copy from log to disk
+  recover_trans(); // if committed, copy from log to disk
   log.lh.n = 0;
   write_head(); // clear the log
 }
 
+// Called at the start of each file system system call.
 void
 begin_trans(void)
 {
   acquire(&log.lock);
-  while (log.busy) {
+  while (log.committing ||
+         log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > log.ndata) {
+    // wait for the commit, or for room in the log
     sleep(&log, &log.lock);
   }
-  log.busy = 1;
+  log.outstanding += 1;
   release(&log.lock);
 }
 
-void
-commit_trans(void)
+static void
+commit(void)
 {
+  if (log.lh.n == 0 && !WRITEBACK)
+    return;
+
+  // The previous transaction's log blocks are reused, and
+  // blocks it freed may be rewritten as data, only once it
+  // has been checkpointed.
+  acquire(&log.lock);
+  while (log.ck.n > 0)
+    sleep(&log, &log.lock);
+  release(&log.lock);
+
+  // Ordered mode: data reaches its home before the
+  // metadata that refers to it commits.
+  if (WRITEBACK)
+    bflush(log.dev);
+
   if (log.lh.n > 0) {
+    write_log();     // Write modified blocks from cache to log
     write_head();    // Write header to disk -- the real commit
-    install_trans(); // Now install writes to home locations
+
+    // Hand the transaction to the checkpoint thread.
+    acquire(&log.lock);
+    log.ck = log.lh;
+    memmove(log.ckhome, log.home, sizeof(log.home));
+    memmove(log.ckcopy, log.copy, sizeof(log.copy));
     log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+    wakeup(&log.ck);
+    release(&log.lock);
   }
+}
+
+// Called at the end of each file system system call.
+// Commits if this was the last outstanding operation, unless
+// in write-back mode, where the transaction stays open until
+// the log is nearly full or log_sync() forces a commit.
+void
+commit_trans(void)
+{
+  int do_commit = 0;
 
   acquire(&log.lock);
-  log.busy = 0;
-  wakeup(&log);
+  log.outstanding -= 1;
+  if (log.committing)
+    panic("log.committing");
+  if (log.outstanding == 0 &&
+      (!WRITEBACK || log.force || log.lh.n + MAXOPBLOCKS > log.ndata)) {
+    do_commit = 1;
+    log.committing = 1;
+  } else {
+    // begin_trans() may be waiting for log space, and
+    // this call's unused reservation is free again.
+    wakeup(&log);
+  }
   release(&log.lock);
+
+  if (do_commit) {
+    // call commit w/o holding locks, since not allowed
+    // to sleep with locks.
+    commit();
+    acquire(&log.lock);
+    log.committing = 0;
+    log.force = 0;
+    log.ncommit++;
+    wakeup(&log);
+    release(&log.lock);
+  }
+}
+
+// Commit the open transaction, with every system call that
+// has finished so far, and wait until it is on disk.
+void
+log_sync(void)
+{
+  int seq;
+
+  begin_trans();
+  acquire(&log.lock);
+  log.force = 1;
+  seq = log.ncommit;
+  release(&log.lock);
+  commit_trans();
+
+  // The commit that includes this call may be another's.
+  acquire(&log.lock);
+  while (log.ncommit == seq)
+    sleep(&log, &log.lock);
+  release(&log.lock);
+}
+
+// Body of the flusher thread, which commits the write-back
+// transaction every FLUSHTICKS ticks.
+static void
+flusher(void)
+{
+  uint ticks0;
+
+  for (;;) {
+    acquire(&tickslock);
+    ticks0 = ticks;
+    while (ticks - ticks0 < FLUSHTICKS)
+      sleep(&ticks, &tickslock);
+    release(&tickslock);
+    log_sync();
+  }
 }
 
 // Caller has modified b->data and is done with the buffer.
-// Append the block to the log and record the block number,
-// but don't write the log header (which would commit the write).
+// Record the block number and pin the buffer in the cache;
+// commit copies it to the log.  A block modified several
+// times in one transaction is logged once (absorption).
 // log_write() replaces bwrite(); a typical use is:
 //   bp = bread(...)
 //   modify bp->data[]
@@ -161,23 +459,42 @@ log_write(struct buf *b)
 {
   int i;
 
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
-    panic("too big a transaction");
-  if (!log.busy)
+  acquire(&log.lock);
+  if (log.outstanding < 1)
     panic("write outside of trans");
 
   for (i = 0; i < log.lh.n; i++) {
-    if (log.lh.sector[i] == b->sector)   // log absorbtion?
+    if (log.lh.sector[i] == b->sector)   // log absorbtion
       break;
   }
-  log.lh.sector[i] = b->sector;
-  struct buf *lbuf = bread(b->dev, log.start+i+1);
-  memmove(lbuf->data, b->data, BSIZE);
-  bwrite(lbuf);
-  brelse(lbuf);
-  if (i == log.lh.n)
+  if (i == log.lh.n) {  // Add new block to log
+    if (log.lh.n >= log.ndata)
+      panic("too big a transaction");
+    log.lh.sector[i] = b->sector;
+    log.home[i] = b;
+    bpin(b);
     log.lh.n++;
-  b->flags |= B_DIRTY; // XXX prevent eviction
+  }
+  // The log writes b now; an earlier write-back of its
+  // data must not send uncommitted contents home.
+  b->flags &= ~B_DIRTY;
+  release(&log.lock);
+}
+
+// Caller has modified file data in b and is done with it.
+// In write-back mode, leave b dirty in the cache for the
+// next commit to write home, ahead of the metadata that
+// refers to it; otherwise log it like any other block.
+void
+log_data(struct buf *b)
+{
+  if (!WRITEBACK) {
+    log_write(b);
+    return;
+  }
+  if (log.outstanding < 1)
+    panic("data write outside of trans");
+  b->flags |= B_DIRTY;
 }
 
 //PAGEBREAK!
@@ -30,6 +30,7 @@ main(void)
   pinit();         // process table
   tvinit();        // trap vectors
   binit();         // buffer cache
+  pcacheinit();    // page cache
   fileinit();      // file table
   iinit();         // inode cache
   ideinit();       // disk
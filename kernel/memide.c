@@ -9,18 +9,22 @@
 #include "x86.h"
 #include "traps.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "buf.h"
+#include "fs.h"
 
 extern uchar _binary_fs_img_start[], _binary_fs_img_size[];
 
 static int disksize;
+
+int ideirq = IRQ_IDE;
 static uchar *memdisk;
 
 void
 ideinit(void)
 {
   memdisk = _binary_fs_img_start;
-  disksize = (uint)_binary_fs_img_size/512;
+  disksize = (uint64)_binary_fs_img_size/BSIZE;
 }
 
 // Interrupt handler.
@@ -38,21 +42,47 @@ iderw(struct buf *b)
 {
   uchar *p;
 
-  if(!(b->flags & B_BUSY))
-    panic("iderw: buf not busy");
+  if(!holdingsleep(&b->lock))
+    panic("iderw: buf not locked");
   if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
     panic("iderw: nothing to do");
   if(b->dev != 1)
     panic("iderw: request not for disk 1");
   if(b->sector >= disksize)
-    panic("iderw: sector out of range");
+    panic("iderw: block out of range");
 
-  p = memdisk + b->sector*512;
+  p = memdisk + (uint64)b->sector*BSIZE;
 
   if(b->flags & B_DIRTY){
     b->flags &= ~B_DIRTY;
-    memmove(p, b->data, 512);
+    memmove(p, b->data, BSIZE);
   } else
-    memmove(b->data, p, 512);
+    memmove(b->data, p, BSIZE);
   b->flags |= B_VALID;
 }
+
+// The memory disk finishes at once, so do each request
+// and call its completion callback before returning.
+void
+idesubmit(struct buf **bs, int n)
+{
+  struct buf *b;
+  int i;
+
+  for(i = 0; i < n; i++){
+    b = bs[i];
+    iderw(b);
+    if(b->iodone)
+      b->iodone(b);
+  }
+}
+
+void
+ideawait(struct buf *b)
+{
+}
+
+void
+idedump(void)
+{
+}
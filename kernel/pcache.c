@@ -0,0 +1,246 @@
+// Page cache.
+//
+// The page cache holds file contents in PGSIZE pages
+// indexed by (dev, inum, file offset / PGSIZE), so readi
+// can copy whole pages instead of one block at a time.
+// Metadata (inodes, bitmaps, indirect blocks) stays in
+// the buffer cache.  Pages are write-through: writei
+// updates the blocks through the log as before and then
+// any cached page, so the buffer cache and disk never
+// disagree with the page cache.
+//
+// Interface:
+// * pget returns a locked page for an offset, which the
+//     caller fills (see readi) if it is not valid.
+// * plookup returns a locked page only if it is cached.
+// * pput releases a page.
+// * pinval drops all pages of a truncated file.
+//
+// Callers hold the inode lock, shared for pget and
+// exclusive for plookup and pinval, so writers never race
+// with readers of the same file.  A page's sleep lock
+// only serializes readers filling it.  Page frames come
+// from kalloc, which can take back idle ones via preclaim.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "pcache.h"
+
+#define NPHASH 61
+#define PHASH(dev, inum, pgno) (((dev)*31 + (inum)*17 + (pgno)) % NPHASH)
+
+struct {
+  struct spinlock lock;
+  struct page page[NPCACHE];
+  struct page *hash[NPHASH];
+
+  // Linked list of all pages, through prev/next.
+  // head.next is most recently used.
+  struct page head;
+
+  int nframe;  // pages with a frame
+  uint64 hits;
+  uint64 misses;
+} pcache;
+
+void
+pcacheinit(void)
+{
+  struct page *pg;
+
+  initlock(&pcache.lock, "pcache");
+  pcache.head.prev = &pcache.head;
+  pcache.head.next = &pcache.head;
+  for(pg = pcache.page; pg < pcache.page+NPCACHE; pg++){
+    pg->next = pcache.head.next;
+    pg->prev = &pcache.head;
+    pg->dev = -1;
+    initsleeplock(&pg->lock, "page");
+    pcache.head.next->prev = pg;
+    pcache.head.next = pg;
+  }
+}
+
+// Find a cached page.  Caller must hold pcache.lock.
+static struct page*
+pfind(uint dev, uint inum, uint pgno)
+{
+  struct page *pg;
+
+  for(pg = pcache.hash[PHASH(dev, inum, pgno)]; pg; pg = pg->hnext)
+    if(pg->dev == dev && pg->inum == inum && pg->pgno == pgno)
+      return pg;
+  return 0;
+}
+
+// Take pg off its hash chain and mark it holding no page.
+// Caller must hold pcache.lock.
+static void
+punhash(struct page *pg)
+{
+  struct page **pp;
+
+  pp = &pcache.hash[PHASH(pg->dev, pg->inum, pg->pgno)];
+  for(; *pp != pg; pp = &(*pp)->hnext)
+    if(*pp == 0)
+      panic("punhash");
+  *pp = pg->hnext;
+  pg->hnext = 0;
+  pg->dev = -1;
+  pg->valid = 0;
+}
+
+// Return a locked page for page pgno of file (dev, inum),
+// recycling the least recently used idle page if it is not
+// cached.  The page is not valid if it was not cached.
+// Returns 0 if every page is busy or no memory is free.
+struct page*
+pget(uint dev, uint inum, uint pgno)
+{
+  struct page *pg;
+  char *mem;
+
+  acquire(&pcache.lock);
+  if((pg = pfind(dev, inum, pgno)) != 0){
+    pcache.hits++;
+    pg->refcnt++;
+    release(&pcache.lock);
+    acquiresleep(&pg->lock);
+    return pg;
+  }
+  release(&pcache.lock);
+
+  // Not cached.  If some pages have no frame yet, allocate
+  // one now, since kalloc may call preclaim.
+  mem = 0;
+  if(pcache.nframe < NPCACHE)
+    mem = kalloc();
+
+  acquire(&pcache.lock);
+  if((pg = pfind(dev, inum, pgno)) != 0){
+    pcache.hits++;
+    pg->refcnt++;
+  } else {
+    for(pg = pcache.head.prev; pg != &pcache.head; pg = pg->prev)
+      if(pg->refcnt == 0 && (pg->data || mem))
+        break;
+    if(pg == &pcache.head){
+      release(&pcache.lock);
+      if(mem)
+        kfree(mem);
+      return 0;
+    }
+    pcache.misses++;
+    if(pg->dev != -1)
+      punhash(pg);
+    if(pg->data == 0){
+      pg->data = mem;
+      mem = 0;
+      pcache.nframe++;
+    }
+    pg->dev = dev;
+    pg->inum = inum;
+    pg->pgno = pgno;
+    pg->valid = 0;
+    pg->refcnt = 1;
+    pg->hnext = pcache.hash[PHASH(dev, inum, pgno)];
+    pcache.hash[PHASH(dev, inum, pgno)] = pg;
+  }
+  release(&pcache.lock);
+  if(mem)
+    kfree(mem);
+  acquiresleep(&pg->lock);
+  return pg;
+}
+
+// Return page pgno of file (dev, inum), locked,
+// if it is cached and valid; otherwise 0.
+struct page*
+plookup(uint dev, uint inum, uint pgno)
+{
+  struct page *pg;
+
+  acquire(&pcache.lock);
+  if((pg = pfind(dev, inum, pgno)) == 0 || !pg->valid){
+    release(&pcache.lock);
+    return 0;
+  }
+  pg->refcnt++;
+  release(&pcache.lock);
+  acquiresleep(&pg->lock);
+  return pg;
+}
+
+// Release a locked page.
+// Move to the head of the MRU list.
+void
+pput(struct page *pg)
+{
+  releasesleep(&pg->lock);
+
+  acquire(&pcache.lock);
+  pg->refcnt--;
+  if(pg->refcnt == 0){
+    pg->next->prev = pg->prev;
+    pg->prev->next = pg->next;
+    pg->next = pcache.head.next;
+    pg->prev = &pcache.head;
+    pcache.head.next->prev = pg;
+    pcache.head.next = pg;
+  }
+  release(&pcache.lock);
+}
+
+// Drop every cached page of file (dev, inum).
+void
+pinval(uint dev, uint inum)
+{
+  struct page *pg;
+
+  acquire(&pcache.lock);
+  for(pg = pcache.page; pg < pcache.page+NPCACHE; pg++){
+    if(pg->dev != dev || pg->inum != inum)
+      continue;
+    if(pg->refcnt != 0)
+      panic("pinval");
+    punhash(pg);
+  }
+  release(&pcache.lock);
+}
+
+// Give the frame of the least recently used idle page
+// back to kalloc.  Returns the frame, or 0 if none.
+char*
+preclaim(void)
+{
+  struct page *pg;
+  char *mem;
+
+  acquire(&pcache.lock);
+  for(pg = pcache.head.prev; pg != &pcache.head; pg = pg->prev){
+    if(pg->refcnt == 0 && pg->data){
+      if(pg->dev != -1)
+        punhash(pg);
+      mem = pg->data;
+      pg->data = 0;
+      pcache.nframe--;
+      release(&pcache.lock);
+      return mem;
+    }
+  }
+  release(&pcache.lock);
+  return 0;
+}
+
+// Print page cache statistics.
+// Runs when user types ^B on console.
+void
+pcachedump(void)
+{
+  cprintf("pcache: %d pages (%d with frames) hit %l miss %l\n",
+          NPCACHE, pcache.nframe, pcache.hits, pcache.misses);
+}
@@ -0,0 +1,84 @@
+// PCI configuration space access, via the legacy
+// 0xCF8/0xCFC mechanism, and a bus scan to find devices.
+
+#include "types.h"
+#include "defs.h"
+#include "x86.h"
+#include "pci.h"
+
+#define PCI_CONFIG_ADDR 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
+
+#define PCI_ID      0x00  // vendor, device
+#define PCI_COMMAND 0x04  // command, status
+#define PCI_CLASS   0x08  // revision, prog if, subclass, class
+#define PCI_HEADER  0x0c  // ..., header type, ...
+#define PCI_BAR0    0x10
+#define PCI_INTR    0x3c  // interrupt line, pin, ...
+
+#define PCI_CMD_IO     0x1
+#define PCI_CMD_MEM    0x2
+#define PCI_CMD_MASTER 0x4
+
+static uint
+pciaddr(uint bus, uint dev, uint func, uint off)
+{
+  return 0x80000000 | (bus<<16) | (dev<<11) | (func<<8) | (off & 0xfc);
+}
+
+uint
+pciread(struct pcidev *d, uint off)
+{
+  outl(PCI_CONFIG_ADDR, pciaddr(d->bus, d->dev, d->func, off));
+  return inl(PCI_CONFIG_DATA);
+}
+
+void
+pciwrite(struct pcidev *d, uint off, uint v)
+{
+  outl(PCI_CONFIG_ADDR, pciaddr(d->bus, d->dev, d->func, off));
+  outl(PCI_CONFIG_DATA, v);
+}
+
+// Find the first PCI function with the given vendor and
+// device ids, or with the given class and subclass if
+// vendor is 0, and fill in *d.  Returns 0 if found, -1 if not.
+int
+pcifind(int vendor, int device, int class, int subclass, struct pcidev *d)
+{
+  uint id, cls, nfunc, i;
+
+  for(d->bus = 0; d->bus < 256; d->bus++){
+    for(d->dev = 0; d->dev < 32; d->dev++){
+      nfunc = 1;
+      for(d->func = 0; d->func < nfunc; d->func++){
+        id = pciread(d, PCI_ID);
+        if((id & 0xffff) == 0xffff)
+          continue;
+        if(d->func == 0 && (pciread(d, PCI_HEADER) & 0x800000))
+          nfunc = 8;  // multi-function device
+        cls = pciread(d, PCI_CLASS);
+        if(vendor ? ((id & 0xffff) != vendor || (id >> 16) != device)
+                  : ((cls >> 24) != class || ((cls >> 16) & 0xff) != subclass))
+          continue;
+        d->vendor = id & 0xffff;
+        d->device = id >> 16;
+        d->class = cls >> 24;
+        d->subclass = (cls >> 16) & 0xff;
+        d->irq = pciread(d, PCI_INTR) & 0xff;
+        for(i = 0; i < 6; i++)
+          d->bar[i] = pciread(d, PCI_BAR0 + 4*i);
+        return 0;
+      }
+    }
+  }
+  return -1;
+}
+
+// Let d respond to I/O and memory accesses and master the bus.
+void
+pcienable(struct pcidev *d)
+{
+  pciwrite(d, PCI_COMMAND, pciread(d, PCI_COMMAND) |
+           PCI_CMD_IO | PCI_CMD_MEM | PCI_CMD_MASTER);
+}
@@ -3,19 +3,42 @@
 #include "param.h"
 #include "mmu.h"
 #include "proc.h"
+#include "spinlock.h"
+#include "sleeplock.h"
 #include "fs.h"
 #include "file.h"
-#include "spinlock.h"
 
-#define PIPESIZE 512
+#define min(a, b) ((a) < (b) ? (a) : (b))
 
+#define PIPESIZE     2048  // default buffer, kept in the pipe's own page
+#define PIPEMAXPAGES   16  // largest buffer, in pages
+
+// The ring buffer is an array of equal-sized segments: either
+// the single data[] array that shares the pipe's page, or up
+// to PIPEMAXPAGES separately allocated pages after a resize.
+// size is a power of two, so nread and nwrite can wrap freely.
+//
+// Only readers advance nread and only writers advance nwrite,
+// so with one reader and one writer the data path needs no
+// shared lock: each side takes only its own rlock or wlock,
+// which merely orders multiple readers or writers.  p->lock
+// is taken only to sleep and wake up, and a waker skips it
+// (and the ptable.lock inside wakeup) unless the other side
+// has announced a sleeper in rsleep or wsleep.
 struct pipe {
-  struct spinlock lock;
-  char data[PIPESIZE];
+  struct spinlock lock;   // sleep/wakeup, open flags, resize
+  struct spinlock rlock;  // serializes readers
+  struct spinlock wlock;  // serializes writers
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
+  int rsleep;     // readers sleeping on nread
+  int wsleep;     // writers sleeping on nwrite
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  uint size;      // bytes in the ring buffer
+  uint segsize;   // bytes per segment
+  char *seg[PIPEMAXPAGES];  // ring buffer segments
+  char data[PIPESIZE];
 };
 
 int
@@ -23,6 +46,9 @@ pipealloc(struct file **f0, struct file **f1)
 {
   struct pipe *p;
 
+  if(sizeof(struct pipe) > PGSIZE)
+    panic("pipealloc: struct pipe too big");
+
   p = 0;
   *f0 = *f1 = 0;
   if((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
@@ -33,7 +59,15 @@ pipealloc(struct file **f0, struct file **f1)
   p->writeopen = 1;
   p->nwrite = 0;
   p->nread = 0;
+  p->rsleep = 0;
+  p->wsleep = 0;
+  p->size = PIPESIZE;
+  p->segsize = PIPESIZE;
+  memset(p->seg, 0, sizeof(p->seg));
+  p->seg[0] = p->data;
   initlock(&p->lock, "pipe");
+  initlock(&p->rlock, "piperead");
+  initlock(&p->wlock, "pipewrite");
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
   (*f0)->writable = 0;
@@ -55,6 +89,19 @@ pipealloc(struct file **f0, struct file **f1)
   return -1;
 }
 
+// Free the pages of a resized ring buffer.
+static void
+freesegs(char **seg, uint size)
+{
+  int i;
+
+  if(size <= PIPESIZE)
+    return;
+  for(i = 0; i < size / PGSIZE; i++)
+    if(seg[i])
+      kfree(seg[i]);
+}
+
 void
 pipeclose(struct pipe *p, int writable)
 {
@@ -68,53 +115,261 @@ pipeclose(struct pipe *p, int writable)
   }
   if(p->readopen == 0 && p->writeopen == 0){
     release(&p->lock);
+    freesegs(p->seg, p->size);
     kfree((char*)p);
   } else
     release(&p->lock);
 }
 
-//PAGEBREAK: 40
-int
-pipewrite(struct pipe *p, char *addr, int n)
+// Return the address of byte i of p's ring buffer,
+// and in *n how many bytes are contiguous with it.
+static char*
+pipeaddr(struct pipe *p, uint i, uint *n)
+{
+  uint off;
+
+  off = i % p->size;
+  *n = p->segsize - off % p->segsize;
+  return p->seg[off / p->segsize] + off % p->segsize;
+}
+
+// Copy up to n bytes from addr into p's free space.
+// Caller must hold p->wlock.  Returns the number copied.
+// The acquire load of nread keeps the copy from overwriting
+// bytes the reader has not finished with; the release store
+// of nwrite publishes the bytes before the new index.
+static int
+pipecopyin(struct pipe *p, char *addr, int n)
 {
+  uint c, m, nread;
   int i;
+  char *dst;
 
-  acquire(&p->lock);
-  for(i = 0; i < n; i++){
-    while(p->nwrite == p->nread + PIPESIZE){  //DOC: pipewrite-full
-      if(p->readopen == 0 || proc->killed){
-        release(&p->lock);
-        return -1;
-      }
-      wakeup(&p->nread);
-      sleep(&p->nwrite, &p->lock);  //DOC: pipewrite-sleep
-    }
-    p->data[p->nwrite++ % PIPESIZE] = addr[i];
+  nread = __atomic_load_n(&p->nread, __ATOMIC_ACQUIRE);
+  for(i = 0; i < n && p->nwrite != nread + p->size; i += m){
+    dst = pipeaddr(p, p->nwrite, &c);
+    m = min(n - i, p->size - (p->nwrite - nread));
+    m = min(m, c);
+    memmove(dst, addr + i, m);
+    __atomic_store_n(&p->nwrite, p->nwrite + m, __ATOMIC_RELEASE);
   }
-  wakeup(&p->nread);  //DOC: pipewrite-wakeup1
-  release(&p->lock);
-  return n;
+  return i;
 }
 
-int
-piperead(struct pipe *p, char *addr, int n)
+// Copy up to n buffered bytes out of p to addr.
+// Caller must hold p->rlock.  Returns the number copied.
+static int
+pipecopyout(struct pipe *p, char *addr, int n)
 {
+  uint c, m, nwrite;
   int i;
+  char *src;
 
+  nwrite = __atomic_load_n(&p->nwrite, __ATOMIC_ACQUIRE);
+  for(i = 0; i < n && p->nread != nwrite; i += m){  //DOC: piperead-copy
+    src = pipeaddr(p, p->nread, &c);
+    m = min(n - i, nwrite - p->nread);
+    m = min(m, c);
+    memmove(addr + i, src, m);
+    __atomic_store_n(&p->nread, p->nread + m, __ATOMIC_RELEASE);
+  }
+  return i;
+}
+
+// Wake the other side of p if it has announced a sleeper
+// in *nsleep.  The fence orders the caller's index update
+// before the check; it pairs with the fence in pipewait*,
+// so either the waker sees the sleeper or the sleeper sees
+// the new index.  p->lock is held across the sleeper's
+// check and sleep(), so taking it here cannot miss one.
+static void
+pipewake(struct pipe *p, int *nsleep, void *chan)
+{
+  __sync_synchronize();
+  if(*nsleep == 0)
+    return;
   acquire(&p->lock);
-  while(p->nread == p->nwrite && p->writeopen){  //DOC: pipe-empty
+  wakeup(chan);
+  release(&p->lock);
+}
+
+// Wait until p has buffered data or no writers.
+// Returns -1 if the process has been killed.
+static int
+pipewaitdata(struct pipe *p)
+{
+  acquire(&p->lock);
+  p->rsleep++;
+  for(;;){
+    __sync_synchronize();
+    if(p->nread != p->nwrite || !p->writeopen)  //DOC: pipe-empty
+      break;
     if(proc->killed){
+      p->rsleep--;
       release(&p->lock);
       return -1;
     }
     sleep(&p->nread, &p->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(p->nread == p->nwrite)
+  p->rsleep--;
+  release(&p->lock);
+  return 0;
+}
+
+// Wait until p has room for more data.
+// Returns -1 if the read side has been closed
+// or the process has been killed.
+int
+pipewaitspace(struct pipe *p)
+{
+  acquire(&p->lock);
+  p->wsleep++;
+  for(;;){
+    __sync_synchronize();
+    if(p->nwrite != p->nread + p->size)  //DOC: pipewrite-full
       break;
-    addr[i] = p->data[p->nread++ % PIPESIZE];
+    if(p->readopen == 0 || proc->killed){
+      p->wsleep--;
+      release(&p->lock);
+      return -1;
+    }
+    sleep(&p->nwrite, &p->lock);  //DOC: pipewrite-sleep
   }
-  wakeup(&p->nwrite);  //DOC: piperead-wakeup
+  p->wsleep--;
   release(&p->lock);
+  return 0;
+}
+
+//PAGEBREAK: 40
+int
+pipewrite(struct pipe *p, char *addr, int n)
+{
+  int i, m;
+
+  for(i = 0; i < n; i += m){
+    acquire(&p->wlock);
+    m = pipecopyin(p, addr + i, n - i);
+    release(&p->wlock);
+    if(m > 0)
+      pipewake(p, &p->rsleep, &p->nread);  //DOC: pipewrite-wakeup1
+    else if(pipewaitspace(p) < 0)
+      return -1;
+  }
+  return n;
+}
+
+int
+piperead(struct pipe *p, char *addr, int n)
+{
+  int i;
+
+  acquire(&p->rlock);
+  while(p->nread == p->nwrite && p->writeopen){
+    release(&p->rlock);
+    if(pipewaitdata(p) < 0)
+      return -1;
+    acquire(&p->rlock);
+  }
+  i = pipecopyout(p, addr, n);
+  release(&p->rlock);
+  if(i > 0)
+    pipewake(p, &p->wsleep, &p->nwrite);  //DOC: piperead-wakeup
+  return i;
+}
+
+// Copy up to n bytes from kernel memory at addr into p
+// without sleeping, for callers that hold a buffer they
+// must not sleep on.  Returns the number of bytes copied,
+// which is 0 if the pipe is full, or -1 if the read side
+// has been closed.
+int
+pipeput(struct pipe *p, char *addr, int n)
+{
+  int i;
+
+  if(p->readopen == 0)
+    return -1;
+  acquire(&p->wlock);
+  i = pipecopyin(p, addr, n);
+  release(&p->wlock);
+  if(i > 0)
+    pipewake(p, &p->rsleep, &p->nread);
   return i;
 }
+
+// Return the size of p's buffer in bytes.
+int
+pipesize(struct pipe *p)
+{
+  return p->size;
+}
+
+//PAGEBREAK!
+// Change the size of p's buffer to at least n bytes,
+// rounded up to a power of two.  Buffers up to PIPESIZE
+// use the space in the pipe's own page; larger ones are
+// built from whole pages.  Fails if n is too large or the
+// data already in the pipe would not fit.
+// Returns the new size.
+int
+piperesize(struct pipe *p, int n)
+{
+  char *seg[PIPEMAXPAGES], *old[PIPEMAXPAGES], *src;
+  uint size, segsize, oldsize, cnt, c, i, m;
+
+  if(n < 0 || n > PIPEMAXPAGES*PGSIZE)
+    return -1;
+  for(size = PIPESIZE; size < n; size *= 2)
+    ;
+
+  // Allocate the new buffer before taking the lock.
+  memset(seg, 0, sizeof(seg));
+  if(size <= PIPESIZE){
+    segsize = size;
+    seg[0] = p->data;
+  } else {
+    segsize = PGSIZE;
+    for(i = 0; i < size / PGSIZE; i++){
+      if((seg[i] = kalloc()) == 0){
+        freesegs(seg, size);
+        return -1;
+      }
+    }
+  }
+
+  acquire(&p->wlock);
+  acquire(&p->rlock);
+  acquire(&p->lock);
+  cnt = p->nwrite - p->nread;
+  if(size == p->size || cnt > size){
+    release(&p->lock);
+    release(&p->rlock);
+    release(&p->wlock);
+    freesegs(seg, size);
+    return size == p->size ? size : -1;
+  }
+
+  // Move the buffered bytes to the start of the new buffer.
+  // Old and new buffers never overlap: at most one of them
+  // is the data[] array.
+  for(i = 0; i < cnt; i += m){
+    src = pipeaddr(p, p->nread + i, &c);
+    m = min(cnt - i, segsize - i % segsize);
+    m = min(m, c);
+    memmove(seg[i / segsize] + i % segsize, src, m);
+  }
+  memmove(old, p->seg, sizeof(old));
+  oldsize = p->size;
+  memmove(p->seg, seg, sizeof(seg));
+  p->size = size;
+  p->segsize = segsize;
+  p->nread = 0;
+  p->nwrite = cnt;
+  wakeup(&p->nwrite);
+  release(&p->lock);
+  release(&p->rlock);
+  release(&p->wlock);
+
+  freesegs(old, oldsize);
+  return size;
+}
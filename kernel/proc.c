@@ -104,6 +104,31 @@ userinit(void)
   p->state = RUNNABLE;
 }
 
+// Start a kernel thread called name running fn, which
+// must never return.  It has no user memory, so it runs
+// only in the kernel, on its own kernel stack.
+// Returns its pid, or -1 if out of memory.
+int
+kthread(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0)
+    return -1;
+  if((p->pml4 = setupkvm()) == 0){
+    kfree(p->kstack);
+    p->kstack = 0;
+    p->state = UNUSED;
+    return -1;
+  }
+  // forkret "returns" to fn instead of trapret.
+  *(uint64*)(p->context + 1) = (uint64)fn;
+  p->parent = initproc;
+  safestrcpy(p->name, name, sizeof(p->name));
+  p->state = RUNNABLE;
+  return p->pid;
+}
+
 // Grow current process's memory by n bytes.
 // Return 0 on success, -1 on failure.
 int
@@ -335,6 +360,7 @@ forkret(void)
     // be run from main().
     first = 0;
     initlog();
+    fsinit(ROOTDEV);
   }
 
   // Return to "caller", actually trapret (see allocproc).
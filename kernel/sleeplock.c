@@ -0,0 +1,150 @@
+// Sleeping locks
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "x86.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+
+void
+initsleeplock(struct sleeplock *lk, char *name)
+{
+  initlock(&lk->lk, name);
+  lk->name = name;
+  lk->locked = 0;
+  lk->pid = 0;
+}
+
+void
+acquiresleep(struct sleeplock *lk)
+{
+  acquire(&lk->lk);
+  while(lk->locked)
+    sleep(lk, &lk->lk);
+  lk->locked = 1;
+  lk->pid = proc->pid;
+  release(&lk->lk);
+}
+
+void
+releasesleep(struct sleeplock *lk)
+{
+  acquire(&lk->lk);
+  lk->locked = 0;
+  lk->pid = 0;
+  wakeup(lk);
+  release(&lk->lk);
+}
+
+// Is the current process holding lk?
+int
+holdingsleep(struct sleeplock *lk)
+{
+  int r;
+
+  acquire(&lk->lk);
+  r = lk->locked && lk->pid == proc->pid;
+  release(&lk->lk);
+  return r;
+}
+
+//PAGEBREAK!
+// Reader-writer sleeping locks
+
+void
+initrwsleeplock(struct rwsleeplock *lk, char *name)
+{
+  initlock(&lk->lk, name);
+  lk->name = name;
+  lk->readers = 0;
+  lk->writer = 0;
+  lk->wwait = 0;
+  lk->pid = 0;
+}
+
+// Acquire lk shared with other readers.
+void
+acquireread(struct rwsleeplock *lk)
+{
+  acquire(&lk->lk);
+  while(lk->writer || lk->wwait)
+    sleep(lk, &lk->lk);
+  lk->readers++;
+  release(&lk->lk);
+}
+
+// Acquire lk exclusively.
+void
+acquirewrite(struct rwsleeplock *lk)
+{
+  acquire(&lk->lk);
+  lk->wwait++;
+  while(lk->writer || lk->readers)
+    sleep(lk, &lk->lk);
+  lk->wwait--;
+  lk->writer = 1;
+  lk->pid = proc->pid;
+  release(&lk->lk);
+}
+
+// Release lk, whichever way the caller holds it.
+void
+releaserw(struct rwsleeplock *lk)
+{
+  acquire(&lk->lk);
+  if(lk->writer){
+    lk->writer = 0;
+    lk->pid = 0;
+  } else if(lk->readers > 0)
+    lk->readers--;
+  else
+    panic("releaserw");
+  if(lk->readers == 0)
+    wakeup(lk);
+  release(&lk->lk);
+}
+
+// Turn the caller's exclusive hold on lk into a shared one,
+// letting other readers in without a window where lk is free.
+void
+downgradewrite(struct rwsleeplock *lk)
+{
+  acquire(&lk->lk);
+  if(!lk->writer || lk->pid != proc->pid)
+    panic("downgradewrite");
+  lk->writer = 0;
+  lk->pid = 0;
+  lk->readers = 1;
+  if(!lk->wwait)
+    wakeup(lk);
+  release(&lk->lk);
+}
+
+// Is the current process holding lk exclusively?
+int
+holdingwrite(struct rwsleeplock *lk)
+{
+  int r;
+
+  acquire(&lk->lk);
+  r = lk->writer && lk->pid == proc->pid;
+  release(&lk->lk);
+  return r;
+}
+
+// Is lk held exclusively by the current process or shared
+// by anyone?  Shared holders are not tracked individually.
+int
+holdingrw(struct rwsleeplock *lk)
+{
+  int r;
+
+  acquire(&lk->lk);
+  r = (lk->writer && lk->pid == proc->pid) || lk->readers > 0;
+  release(&lk->lk);
+  return r;
+}
@@ -9,12 +9,32 @@
 #include "proc.h"
 #include "spinlock.h"
 
+// Locks in static storage, for lockdump().  Locks embedded
+// in kalloc'd memory (such as pipes) come and go, so they
+// keep statistics but are not listed.
+#define NLOCKSTAT 256
+static struct spinlock *locks[NLOCKSTAT];
+static uint nlocks;
+
 void
 initlock(struct spinlock *lk, char *name)
 {
+  extern char end[];
+  uint i;
+
   lk->name = name;
-  lk->locked = 0;
+  lk->next = 0;
+  lk->owner = 0;
   lk->cpu = 0;
+  lk->nacquire = 0;
+  lk->ncontend = 0;
+  lk->spin = 0;
+  lk->holdmax = 0;
+
+  // Can run before this cpu is set up, so no acquire().
+  if((char*)lk < end && nlocks < NLOCKSTAT &&
+     (i = xadd(&nlocks, 1)) < NLOCKSTAT)
+    locks[i] = lk;
 }
 
 // Acquire the lock.
@@ -24,45 +44,116 @@ initlock(struct spinlock *lk, char *name)
 void
 acquire(struct spinlock *lk)
 {
+  uint ticket;
+  uint64 t0, now;
+
   pushcli(); // disable interrupts to avoid deadlock.
   if(holding(lk))
     panic("acquire");
 
-  // The xchg is atomic.
+  // The xadd is atomic.
   // It also serializes, so that reads after acquire are not
   // reordered before it.
-  while(xchg(&lk->locked, 1) != 0)
-    ;
+  ticket = xadd(&lk->next, 1);
+  t0 = 0;
+  if(lk->owner != ticket){
+    t0 = rdtsc();
+    while(lk->owner != ticket)
+      pause();
+  }
+  now = rdtsc();
 
   // Record info about lock acquisition for debugging.
   lk->cpu = cpu;
   getcallerpcs(&lk, lk->pcs);
+  lk->nacquire++;
+  if(t0){
+    lk->ncontend++;
+    lk->spin += now - t0;
+  }
+  lk->tacquire = now;
 }
 
 // Release the lock.
 void
 release(struct spinlock *lk)
 {
+  uint64 hold;
+
   if(!holding(lk))
     panic("release");
 
+  hold = rdtsc() - lk->tacquire;
+  if(hold > lk->holdmax)
+    lk->holdmax = hold;
   lk->pcs[0] = 0;
   lk->cpu = 0;
 
+  // Hand the lock to the next ticket.
   // The xchg serializes, so that reads before release are
   // not reordered after it.  The 1996 PentiumPro manual (Volume 3,
   // 7.2) says reads can be carried out speculatively and in
   // any order, which implies we need to serialize here.
   // But the 2007 Intel 64 Architecture Memory Ordering White
   // Paper says that Intel 64 and IA-32 will not move a load
-  // after a store. So lock->locked = 0 would work here.
+  // after a store. So lk->owner++ would work here.
   // The xchg being asm volatile ensures gcc emits it after
   // the above assignments (and after the critical section).
-  xchg(&lk->locked, 0);
+  xchg(&lk->owner, lk->owner + 1);
 
   popcli();
 }
 
+// Print contention statistics for the locks in static storage.
+// Locks sharing a name, such as the per-inode locks, are summed
+// into one line.  Runs when user types ^T on console.
+// No lock, like procdump, so counts may be slightly stale.
+void
+lockdump(void)
+{
+  struct spinlock *lk, *held, sum;
+  uint i, j, n, nsame;
+
+  n = nlocks < NLOCKSTAT ? nlocks : NLOCKSTAT;
+  for(i = 0; i < n; i++){
+    if(locks[i] == 0)
+      continue;
+    for(j = 0; j < i; j++)
+      if(locks[j] && locks[j]->name == locks[i]->name)
+        break;
+    if(j < i)
+      continue;  // already printed with an earlier lock
+
+    memset(&sum, 0, sizeof(sum));
+    held = 0;
+    nsame = 0;
+    for(j = i; j < n; j++){
+      lk = locks[j];
+      if(lk == 0 || lk->name != locks[i]->name)
+        continue;
+      nsame++;
+      sum.nacquire += lk->nacquire;
+      sum.ncontend += lk->ncontend;
+      sum.spin += lk->spin;
+      if(lk->holdmax > sum.holdmax)
+        sum.holdmax = lk->holdmax;
+      if(lk->cpu)
+        held = lk;
+    }
+    if(sum.nacquire == 0)
+      continue;
+    cprintf("%s", locks[i]->name);
+    if(nsame > 1)
+      cprintf(" (%d)", nsame);
+    cprintf(": acquire %l contend %l spin %l holdmax %l",
+            sum.nacquire, sum.ncontend, sum.spin, sum.holdmax);
+    if(held)
+      for(j = 0; j < 10 && held->pcs[j] != 0; j++)
+        cprintf(" %p", held->pcs[j]);
+    cprintf("\n");
+  }
+}
+
 // Record the current call stack in pcs[] by following the %ebp chain.
 void
 getcallerpcs(void *v, uint64 pcs[])
@@ -89,7 +180,7 @@ getcallerpcs(void *v, uint64 pcs[])
 int
 holding(struct spinlock *lock)
 {
-  return lock->locked && lock->cpu == cpu;
+  return lock->owner != lock->next && lock->cpu == cpu;
 }
 
 
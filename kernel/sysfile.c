@@ -10,6 +10,8 @@
 #include "stat.h"
 #include "mmu.h"
 #include "proc.h"
+#include "spinlock.h"
+#include "sleeplock.h"
 #include "fs.h"
 #include "file.h"
 #include "fcntl.h"
@@ -87,6 +89,164 @@ sys_write(void)
   return filewrite(f, p, n);
 }
 
+// Fetch the iovec array passed as the nth and n+1th system call
+// arguments and check that every buffer lies within the process
+// address space.  Returns the number of vectors.
+static int
+argiov(int n, struct iovec **piov)
+{
+  int i, iovcnt;
+  struct iovec *iov;
+
+  if(argint(n+1, &iovcnt) < 0 || iovcnt < 0 || iovcnt > MAXIOV)
+    return -1;
+  if(argptr(n, (void*)&iov, iovcnt*sizeof(*iov)) < 0)
+    return -1;
+  for(i = 0; i < iovcnt; i++){
+    if(iov[i].len < 0)
+      return -1;
+    if(iov[i].len == 0)
+      continue;
+    if((uint64)iov[i].base >= proc->sz ||
+       (uint64)iov[i].base + iov[i].len > proc->sz)
+      return -1;
+  }
+  *piov = iov;
+  return iovcnt;
+}
+
+int
+sys_readv(void)
+{
+  struct file *f;
+  struct iovec *iov;
+  int iovcnt;
+
+  if(argfd(0, 0, &f) < 0 || (iovcnt = argiov(1, &iov)) < 0)
+    return -1;
+  return filereadv(f, iov, iovcnt);
+}
+
+int
+sys_writev(void)
+{
+  struct file *f;
+  struct iovec *iov;
+  int iovcnt;
+
+  if(argfd(0, 0, &f) < 0 || (iovcnt = argiov(1, &iov)) < 0)
+    return -1;
+  return filewritev(f, iov, iovcnt);
+}
+
+int
+sys_pread(void)
+{
+  struct file *f;
+  int n, off;
+  char *p;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0 ||
+     argint(3, &off) < 0 || off < 0)
+    return -1;
+  return filepread(f, p, n, off);
+}
+
+int
+sys_pwrite(void)
+{
+  struct file *f;
+  int n, off;
+  char *p;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0 ||
+     argint(3, &off) < 0 || off < 0)
+    return -1;
+  return filepwrite(f, p, n, off);
+}
+
+int
+sys_lseek(void)
+{
+  struct file *f;
+  int off, whence;
+
+  if(argfd(0, 0, &f) < 0 || argint(1, &off) < 0 || argint(2, &whence) < 0)
+    return -1;
+  return fileseek(f, off, whence);
+}
+
+// Move data from in_fd to out_fd inside the kernel.
+int
+sys_sendfile(void)
+{
+  struct file *out, *in;
+  int n;
+
+  if(argfd(0, 0, &out) < 0 || argfd(1, 0, &in) < 0 || argint(2, &n) < 0)
+    return -1;
+  return filesend(out, in, n);
+}
+
+// Like sendfile, but one side must be a pipe.
+int
+sys_splice(void)
+{
+  struct file *in, *out;
+  int n;
+
+  if(argfd(0, 0, &in) < 0 || argfd(1, 0, &out) < 0 || argint(2, &n) < 0)
+    return -1;
+  if(in->type != FD_PIPE && out->type != FD_PIPE)
+    return -1;
+  return filesend(out, in, n);
+}
+
+int
+sys_fcntl(void)
+{
+  struct file *f;
+  int cmd, arg;
+
+  if(argfd(0, 0, &f) < 0 || argint(1, &cmd) < 0 || argint(2, &arg) < 0)
+    return -1;
+  return filectl(f, cmd, arg);
+}
+
+int
+sys_fsync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  return filesync(f);
+}
+
+int
+sys_sync(void)
+{
+  log_sync();
+  return 0;
+}
+
+// Report free space on the file system holding path.
+int
+sys_statfs(void)
+{
+  char *path;
+  struct statfs *st;
+  struct inode *ip;
+
+  if(argstr(0, &path) < 0 || argptr(1, (void*)&st, sizeof(*st)) < 0)
+    return -1;
+  if((ip = namei(path)) == 0)
+    return -1;
+  fsstat(ip->dev, st);
+  iput(ip);
+  return 0;
+}
+
 int
 sys_close(void)
 {
@@ -180,7 +340,6 @@ int
 sys_unlink(void)
 {
   struct inode *ip, *dp;
-  struct dirent de;
   char name[DIRSIZ], *path;
   uint off;
 
@@ -208,9 +367,7 @@ sys_unlink(void)
     goto bad;
   }
 
-  memset(&de, 0, sizeof(de));
-  if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-    panic("unlink: writei");
+  dirunlink(dp, off);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -295,7 +452,7 @@ sys_open(void)
   } else {
     if((ip = namei(path)) == 0)
       return -1;
-    ilock(ip);
+    ilockshared(ip);
     if(ip->type == T_DIR && omode != O_RDONLY){
       iunlockput(ip);
       return -1;
@@ -363,7 +520,7 @@ sys_chdir(void)
 
   if(argstr(0, &path) < 0 || (ip = namei(path)) == 0)
     return -1;
-  ilock(ip);
+  ilockshared(ip);
   if(ip->type != T_DIR){
     iunlockput(ip);
     return -1;
@@ -80,6 +80,12 @@ trap(struct trapframe *tf)
 
   //PAGEBREAK: 13
   default:
+    if(tf->trapno == T_IRQ0 + ideirq){
+      // A disk whose interrupt line is not IRQ_IDE.
+      ideintr();
+      lapiceoi();
+      break;
+    }
     if(proc == 0 || (tf->cs&3) == 0){
       // In kernel, it must be our mistake.
       cprintf("unexpected trap %d from cpu %d rip %p (cr2=0x%p) err=%p\n",
@@ -0,0 +1,343 @@
+// Driver for a legacy virtio-blk PCI device, such as QEMU's
+// -device virtio-blk-pci,disable-modern=on.  Provides the same
+// interface as ide.c, for the file system disk (dev 1), but
+// keeps up to NVREQ requests in flight at once, each moving a
+// run of adjacent blocks with one descriptor per buffer.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "x86.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "buf.h"
+#include "fs.h"
+#include "pci.h"
+#include "iosched.h"
+
+// Legacy virtio PCI registers, at an offset from BAR 0.
+#define VIO_HOSTFEAT  0x00
+#define VIO_GUESTFEAT 0x04
+#define VIO_QPFN      0x08
+#define VIO_QSIZE     0x0c
+#define VIO_QSEL      0x0e
+#define VIO_QNOTIFY   0x10
+#define VIO_STATUS    0x12
+#define VIO_ISR       0x13
+
+#define VIO_ST_ACK    0x01
+#define VIO_ST_DRIVER 0x02
+#define VIO_ST_OK     0x04
+
+// Virtqueue structures, as laid out in memory.
+struct vdesc {
+  uint64 addr;
+  uint len;
+  ushort flags;
+  ushort next;
+};
+#define VDESC_NEXT  0x1  // chain continues in next
+#define VDESC_WRITE 0x2  // device writes the buffer
+
+struct vavail {
+  ushort flags;
+  ushort idx;
+  ushort ring[];
+};
+
+struct vusedelem {
+  uint id;
+  uint len;
+};
+
+struct vused {
+  ushort flags;
+  ushort idx;
+  struct vusedelem ring[];
+};
+
+// virtio-blk request header.
+struct vblkhdr {
+  uint type;
+  uint reserved;
+  uint64 sector;
+};
+#define VBLK_IN  0  // read
+#define VBLK_OUT 1  // write
+
+#define NVREQ     32  // most requests in flight
+#define VMAXRUN   32  // most bufs per request
+
+// A request in flight: header, status byte, and its bufs
+// linked through qnext.
+struct vreq {
+  struct vblkhdr hdr;
+  uchar status;
+  int busy;
+  int head;          // first descriptor
+  int ndesc;
+  struct buf *run;
+  int n;
+};
+
+static struct spinlock vlock;
+static struct ioqueue vq;       // requests not yet given to the device
+static ushort viobase;
+static int qsize;               // descriptors in the virtqueue
+static struct vdesc *desc;
+static struct vavail *avail;
+static volatile struct vused *used;
+static ushort lastused;         // used->idx already handled
+static ushort freedesc[1024];   // stack of free descriptors
+static int nfreedesc;
+static struct vreq vreqs[NVREQ];
+static int ninflight;
+
+static uchar vqmem[4*PGSIZE] __attribute__((aligned(PGSIZE)));
+
+// Statistics, protected by vlock.
+static struct {
+  uint64 requests;  // bufs transferred
+  uint64 commands;  // device requests
+  uint64 merged;    // bufs done by another's request
+  int maxinflight;
+} vstat;
+
+int ideirq;
+
+void
+ideinit(void)
+{
+  struct pcidev pci;
+  uint64 sz;
+
+  initlock(&vlock, "virtio");
+  ioqinit(&vq, IOSCHED);
+  if(pcifind(0x1af4, 0x1001, 0, 0, &pci) < 0 || !(pci.bar[0] & PCI_BAR_IO))
+    panic("virtio: no legacy virtio-blk device");
+  pcienable(&pci);
+  viobase = pci.bar[0] & ~3;
+
+  outb(viobase+VIO_STATUS, 0);  // reset
+  outb(viobase+VIO_STATUS, VIO_ST_ACK);
+  outb(viobase+VIO_STATUS, VIO_ST_ACK|VIO_ST_DRIVER);
+  outl(viobase+VIO_GUESTFEAT, 0);
+
+  // Lay out queue 0: descriptors and available ring,
+  // then the used ring on the next page boundary.
+  outw(viobase+VIO_QSEL, 0);
+  qsize = inw(viobase+VIO_QSIZE);
+  sz = PGROUNDUP(16*qsize + 6 + 2*qsize) + 6 + 8*qsize;
+  if(qsize == 0 || qsize > NELEM(freedesc) || sz > sizeof(vqmem))
+    panic("virtio: bad queue size");
+  desc = (struct vdesc*)vqmem;
+  avail = (struct vavail*)(vqmem + 16*qsize);
+  used = (struct vused*)(vqmem + PGROUNDUP(16*qsize + 6 + 2*qsize));
+  for(nfreedesc = 0; nfreedesc < qsize; nfreedesc++)
+    freedesc[nfreedesc] = nfreedesc;
+  outl(viobase+VIO_QPFN, v2p(vqmem) >> PGSHIFT);
+
+  outb(viobase+VIO_STATUS, VIO_ST_ACK|VIO_ST_DRIVER|VIO_ST_OK);
+
+  ideirq = pci.irq;
+  ioapicenablepci(ideirq, ncpu - 1);
+}
+
+// Fill in descriptor d and return it.
+static int
+vdesc(int d, void *addr, uint len, int flags, int next)
+{
+  desc[d].addr = v2p(addr);
+  desc[d].len = len;
+  desc[d].flags = flags;
+  desc[d].next = next;
+  return d;
+}
+
+//PAGEBREAK!
+// Give the device as many queued requests as it has room
+// for, each with the queued bufs that continue its run.
+// Caller must hold vlock.
+static void
+vstart(void)
+{
+  struct vreq *r;
+  struct buf *b, *q, *run[VMAXRUN];
+  int i, d, max, started;
+
+  started = 0;
+  while(vq.n > 0 && ninflight < NVREQ && nfreedesc >= 3){
+    for(r = vreqs; r->busy; r++)
+      ;
+    b = run[0] = ioqnext(&vq);
+    r->n = 1;
+    max = nfreedesc - 2 < VMAXRUN ? nfreedesc - 2 : VMAXRUN;
+    while(r->n < max && (q = ioqmerge(&vq, run[r->n-1])) != 0)
+      run[r->n++] = q;
+    r->run = b;
+    for(i = 0; i < r->n; i++)
+      run[i]->qnext = i+1 < r->n ? run[i+1] : 0;
+
+    // Build the chain back to front: header, bufs, status.
+    r->hdr.type = (b->flags & B_DIRTY) ? VBLK_OUT : VBLK_IN;
+    r->hdr.reserved = 0;
+    r->hdr.sector = (uint64)b->sector * BSECT;
+    r->status = 0xff;
+    r->ndesc = r->n + 2;
+    d = vdesc(freedesc[--nfreedesc], &r->status, 1, VDESC_WRITE, 0);
+    for(i = r->n - 1; i >= 0; i--)
+      d = vdesc(freedesc[--nfreedesc], run[i]->data, BSIZE,
+                VDESC_NEXT | ((b->flags & B_DIRTY) ? 0 : VDESC_WRITE), d);
+    r->head = vdesc(freedesc[--nfreedesc], &r->hdr, sizeof(r->hdr), VDESC_NEXT, d);
+    r->busy = 1;
+
+    avail->ring[avail->idx % qsize] = r->head;
+    __sync_synchronize();
+    avail->idx++;
+    started = 1;
+
+    ninflight++;
+    if(ninflight > vstat.maxinflight)
+      vstat.maxinflight = ninflight;
+    vstat.commands++;
+    vstat.requests += r->n;
+    vstat.merged += r->n - 1;
+  }
+  if(started){
+    __sync_synchronize();
+    outw(viobase+VIO_QNOTIFY, 0);
+  }
+}
+
+// Interrupt handler.
+void
+ideintr(void)
+{
+  struct vreq *r;
+  struct buf *b, *next, *cb;
+  int d, i;
+
+  acquire(&vlock);
+  inb(viobase+VIO_ISR);  // acknowledge the interrupt
+
+  // Complete every request the device has finished.  Bufs
+  // with a callback are set aside, to call without vlock.
+  cb = 0;
+  while(lastused != used->idx){
+    __sync_synchronize();
+    d = used->ring[lastused % qsize].id;
+    lastused++;
+    for(r = vreqs; r < vreqs+NVREQ; r++)
+      if(r->busy && r->head == d)
+        break;
+    if(r == vreqs+NVREQ)
+      panic("virtio: unknown request");
+    if(r->status != 0)
+      panic("virtio: I/O error");
+
+    for(i = 0; i < r->ndesc; i++){
+      freedesc[nfreedesc++] = d;
+      d = desc[d].next;
+    }
+    for(b = r->run; b; b = next){
+      next = b->qnext;
+      b->flags |= B_VALID;
+      b->flags &= ~B_DIRTY;
+      ioqdone(&vq, b);
+      if(b->iodone){
+        b->qnext = cb;
+        cb = b;
+      } else
+        wakeup(b);
+    }
+    r->busy = 0;
+    ninflight--;
+  }
+
+  vstart();
+  wakeup(&vq);
+  release(&vlock);
+
+  for(b = cb; b; b = next){
+    next = b->qnext;
+    b->iodone(b);
+  }
+}
+
+//PAGEBREAK!
+// Add b to vq, waiting if it is full.
+// Caller must hold vlock.
+static void
+vqueue(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("iderw: buf not locked");
+  if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
+    panic("iderw: nothing to do");
+  if(b->dev != 1)
+    panic("iderw: request not for disk 1");
+
+  while(ioqfull(&vq)){
+    vstart();
+    sleep(&vq, &vlock);
+  }
+  ioqadd(&vq, b);
+}
+
+// Start syncing n bufs with disk and return at once.
+// Wait for each with ideawait, unless it has an iodone
+// callback, which ideintr calls when it is done instead.
+void
+idesubmit(struct buf **bs, int n)
+{
+  int i;
+
+  acquire(&vlock);
+  for(i = 0; i < n; i++)
+    vqueue(bs[i]);
+  vstart();
+  release(&vlock);
+}
+
+// Wait for the request for b to finish.
+void
+ideawait(struct buf *b)
+{
+  acquire(&vlock);
+  while((b->flags & (B_VALID|B_DIRTY)) != B_VALID){
+    sleep(b, &vlock);
+  }
+  release(&vlock);
+}
+
+// Sync buf with disk.
+// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
+// Else if B_VALID is not set, read buf from disk, set B_VALID.
+void
+iderw(struct buf *b)
+{
+  acquire(&vlock);
+  vqueue(b);
+  vstart();
+  while((b->flags & (B_VALID|B_DIRTY)) != B_VALID){
+    sleep(b, &vlock);
+  }
+  release(&vlock);
+}
+
+// Print disk request statistics.
+// Runs when user types ^B on console.
+void
+idedump(void)
+{
+  uint64 avg;
+
+  avg = vstat.commands ? vstat.requests*BSIZE / vstat.commands : 0;
+  cprintf("virtio: %l requests %l commands %l merged, %l bytes per command\n",
+          vstat.requests, vstat.commands, vstat.merged, avg);
+  cprintf("virtio: %d in flight, at most %d\n", ninflight, vstat.maxinflight);
+  ioqdump(&vq);
+}
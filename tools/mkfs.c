@@ -13,14 +13,14 @@
 
 #define Static_assert(a, b) do { switch (0) case 0: case (a): ; } while (0)
 
-int nblocks = 985;
-int nlog = LOGSIZE;
+int nblocks;  // data blocks: what the rest leaves of size
+int nlog = 3*MAXOPBLOCKS + 2;  // header blocks plus three operations
 int ninodes = 200;
-int size = 1024;
+int size = 2048;  // blocks of BSIZE bytes
 
 int fsfd;
 struct superblock sb;
-char zeroes[512];
+char zeroes[BSIZE];
 uint freeblock;
 uint usedblocks;
 uint bitblocks;
@@ -33,6 +33,7 @@ void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+void iindex(uint inum);
 
 // convert to intel byte order
 ushort
@@ -63,19 +64,24 @@ main(int argc, char *argv[])
   int i, cc, fd;
   uint rootino, inum, off;
   struct dirent de;
-  char buf[512];
+  char buf[BSIZE];
   struct dinode din;
 
 
   Static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
-  if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+  if(argc > 2 && strcmp(argv[1], "-l") == 0){
+    nlog = atoi(argv[2]);
+    argc -= 2;
+    argv += 2;
+  }
+  if(argc < 2 || nlog < 2 || nlog >= size){
+    fprintf(stderr, "Usage: mkfs [-l logblocks] fs.img files...\n");
     exit(1);
   }
 
-  assert((512 % sizeof(struct dinode)) == 0);
-  assert((512 % sizeof(struct dirent)) == 0);
+  assert((BSIZE % sizeof(struct dinode)) == 0);
+  assert((BSIZE % sizeof(struct dirent)) == 0);
 
   fsfd = open(argv[1], O_RDWR|O_CREAT|O_TRUNC, 0666);
   if(fsfd < 0){
@@ -83,14 +89,17 @@ main(int argc, char *argv[])
     exit(1);
   }
 
+  bitblocks = size/BPB + 1;
+  usedblocks = ninodes / IPB + 3 + bitblocks;
+  freeblock = usedblocks;
+  nblocks = size - usedblocks - nlog;
+  assert(nblocks > 0);
+
   sb.size = xint(size);
   sb.nblocks = xint(nblocks); // so whole disk is size sectors
   sb.ninodes = xint(ninodes);
   sb.nlog = xint(nlog);
-
-  bitblocks = size/(512*8) + 1;
-  usedblocks = ninodes / IPB + 3 + bitblocks;
-  freeblock = usedblocks;
+  sb.bsize = xint(BSIZE);
 
   printf("used %d (bit %d ninode %zu) free %u log %u total %d\n", usedblocks,
          bitblocks, ninodes/IPB + 1, freeblock, nlog, nblocks+usedblocks+nlog);
@@ -149,6 +158,7 @@ main(int argc, char *argv[])
   off = ((off/BSIZE) + 1) * BSIZE;
   din.size = xint(off);
   winode(rootino, &din);
+  iindex(rootino);
 
   balloc(usedblocks);
 
@@ -158,11 +168,11 @@ main(int argc, char *argv[])
 void
 wsect(uint sec, void *buf)
 {
-  if(lseek(fsfd, sec * 512L, 0) != sec * 512L){
+  if(lseek(fsfd, sec * (long)BSIZE, 0) != sec * (long)BSIZE){
     perror("lseek");
     exit(1);
   }
-  if(write(fsfd, buf, 512) != 512){
+  if(write(fsfd, buf, BSIZE) != BSIZE){
     perror("write");
     exit(1);
   }
@@ -177,7 +187,7 @@ i2b(uint inum)
 void
 winode(uint inum, struct dinode *ip)
 {
-  char buf[512];
+  char buf[BSIZE];
   uint bn;
   struct dinode *dip;
 
@@ -191,7 +201,7 @@ winode(uint inum, struct dinode *ip)
 void
 rinode(uint inum, struct dinode *ip)
 {
-  char buf[512];
+  char buf[BSIZE];
   uint bn;
   struct dinode *dip;
 
@@ -204,11 +214,11 @@ rinode(uint inum, struct dinode *ip)
 void
 rsect(uint sec, void *buf)
 {
-  if(lseek(fsfd, sec * 512L, 0) != sec * 512L){
+  if(lseek(fsfd, sec * (long)BSIZE, 0) != sec * (long)BSIZE){
     perror("lseek");
     exit(1);
   }
-  if(read(fsfd, buf, 512) != 512){
+  if(read(fsfd, buf, BSIZE) != BSIZE){
     perror("read");
     exit(1);
   }
@@ -231,12 +241,12 @@ ialloc(ushort type)
 void
 balloc(int used)
 {
-  uchar buf[512];
+  uchar buf[BSIZE];
   int i;
 
   printf("balloc: first %d blocks have been allocated\n", used);
-  assert(used < 512*8);
-  bzero(buf, 512);
+  assert(used < BPB);
+  bzero(buf, BSIZE);
   for(i = 0; i < used; i++){
     buf[i/8] = buf[i/8] | (0x1 << (i%8));
   }
@@ -252,7 +262,7 @@ iappend(uint inum, void *xp, int n)
   char *p = (char*)xp;
   uint fbn, off, n1;
   struct dinode din;
-  char buf[512];
+  char buf[BSIZE];
   uint indirect[NINDIRECT];
   uint x;
 
@@ -260,8 +270,8 @@ iappend(uint inum, void *xp, int n)
 
   off = xint(din.size);
   while(n > 0){
-    fbn = off / 512;
-    assert(fbn < MAXFILE);
+    fbn = off / BSIZE;
+    assert(fbn < NDIRECT + NINDIRECT);
     if(fbn < NDIRECT){
       if(xint(din.addrs[fbn]) == 0){
         din.addrs[fbn] = xint(freeblock++);
@@ -283,9 +293,9 @@ iappend(uint inum, void *xp, int n)
       }
       x = xint(indirect[fbn-NDIRECT]);
     }
-    n1 = min(n, (fbn + 1) * 512 - off);
+    n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
-    bcopy(p, buf + off - (fbn * 512), n1);
+    bcopy(p, buf + off - (fbn * BSIZE), n1);
     wsect(x, buf);
     n -= n1;
     off += n1;
@@ -294,3 +304,93 @@ iappend(uint inum, void *xp, int n)
   din.size = xint(off);
   winode(inum, &din);
 }
+
+// Same as ixhash and ixbucket in fs.c.
+uint
+ixhash(char *name)
+{
+  uint h;
+  int i;
+
+  h = 2166136261U;
+  for(i = 0; i < DIRSIZ && name[i]; i++){
+    h ^= (uchar)name[i];
+    h *= 16777619;
+  }
+  return h;
+}
+
+uint
+ixbucket(uint h, uint n)
+{
+  uint m;
+
+  for(m = 1; m < n; m <<= 1)
+    ;
+  if((h & (m-1)) < n)
+    return h & (m-1);
+  return h & (m/2 - 1);
+}
+
+#define DPB (BSIZE / sizeof(struct dirent))
+
+// Give directory inum a hash index, as the kernel
+// does for directories bigger than one block.
+void
+iindex(uint inum)
+{
+  struct dinode din;
+  struct dirent de[DPB];
+  struct dirindex ix;
+  char buf[BSIZE];
+  struct dirbucket *bk;
+  uint size, nslot, n, slot, b;
+
+  rinode(inum, &din);
+  size = xint(din.size);
+  if(size <= BSIZE)
+    return;
+  assert(size <= NDIRECT*BSIZE);
+  nslot = size / sizeof(struct dirent);
+  for(n = 1; n*NDIRHENT/2 < nslot; n++)
+    ;
+  assert(n <= NDIRBUCKET);
+  bk = calloc(n, sizeof(*bk));
+  assert(bk != 0);
+
+  bzero(&ix, sizeof(ix));
+  ix.freeslot = xint(nslot);
+  for(slot = 0; slot < nslot; slot++){
+    if(slot % DPB == 0)
+      rsect(xint(din.addrs[slot / DPB]), de);
+    if(de[slot % DPB].inum == 0){
+      if(slot < xint(ix.freeslot))
+        ix.freeslot = xint(slot);
+      continue;
+    }
+    b = ixbucket(ixhash(de[slot % DPB].name), n);
+    assert(bk[b].n < NDIRHENT);
+    bk[b].e[bk[b].n].hash = xint(ixhash(de[slot % DPB].name));
+    bk[b].e[bk[b].n].slot = xint(slot);
+    bk[b].n++;
+    ix.nentry++;
+  }
+
+  din.index = xint(freeblock++);
+  usedblocks++;
+  for(b = 0; b < n; b++){
+    ix.bucket[b] = xint(freeblock++);
+    usedblocks++;
+    bk[b].n = xint(bk[b].n);
+    bzero(buf, sizeof(buf));
+    memmove(buf, &bk[b], sizeof(bk[b]));
+    wsect(xint(ix.bucket[b]), buf);
+  }
+  ix.nbucket = xint(n);
+  ix.nentry = xint(ix.nentry);
+  bzero(buf, sizeof(buf));
+  memmove(buf, &ix, sizeof(ix));
+  wsect(xint(din.index), buf);
+  winode(inum, &din);
+  free(bk);
+}
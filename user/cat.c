@@ -9,6 +9,12 @@ cat(int fd)
 {
   int n;
 
+  // Let the kernel move the data when it can, and
+  // copy through buf only if sendfile refuses.
+  while((n = sendfile(1, fd, 4096)) > 0)
+    ;
+  if(n == 0)
+    return;
   while((n = read(fd, buf, sizeof(buf))) > 0)
     write(1, buf, n);
   if(n < 0){
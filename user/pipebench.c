@@ -0,0 +1,68 @@
+// Pipe throughput benchmark.  A producer streams data through
+// a pipe to a consumer, as in usertests' pipe1, once for each
+// of several pipe buffer sizes.
+// Usage: pipebench [megabytes]
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+
+char buf[4096];
+int sizes[] = { 0, 4096, 16384, 65536 };
+
+void
+bench(int size, uint mb)
+{
+  int fds[2], pid, n, t0;
+  uint total;
+
+  if(pipe(fds) != 0){
+    printf(1, "pipebench: pipe failed\n");
+    exit();
+  }
+  if(size > 0 && fcntl(fds[1], F_SETPIPE_SZ, size) < 0){
+    printf(1, "pipebench: cannot resize pipe to %d\n", size);
+    exit();
+  }
+  size = fcntl(fds[1], F_GETPIPE_SZ, 0);
+
+  t0 = uptime();
+  pid = fork();
+  if(pid < 0){
+    printf(1, "pipebench: fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    close(fds[0]);
+    for(total = 0; total < mb*1024*1024; total += sizeof(buf)){
+      if(write(fds[1], buf, sizeof(buf)) != sizeof(buf)){
+        printf(1, "pipebench: write failed\n");
+        exit();
+      }
+    }
+    exit();
+  }
+  close(fds[1]);
+  total = 0;
+  while((n = read(fds[0], buf, sizeof(buf))) > 0)
+    total += n;
+  close(fds[0]);
+  wait();
+  printf(1, "pipe size %d: %d MB in %d ticks\n",
+         size, total / (1024*1024), uptime() - t0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i;
+  uint mb;
+
+  mb = 256;
+  if(argc > 1)
+    mb = atoi(argv[1]);
+  for(i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++)
+    bench(sizes[i], mb);
+  exit();
+}
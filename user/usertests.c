@@ -84,6 +84,9 @@ writetest(void)
   printf(stdout, "small file test ok\n");
 }
 
+// Enough 512-byte chunks to reach into the double indirect blocks.
+#define BIGCHUNKS ((NDIRECT + NINDIRECT + 16) * (BSIZE / 512))
+
 void
 writetest1(void)
 {
@@ -97,7 +100,7 @@ writetest1(void)
     exit();
   }
 
-  for(i = 0; i < MAXFILE; i++){
+  for(i = 0; i < BIGCHUNKS; i++){
     ((int*)buf)[0] = i;
     if(write(fd, buf, 512) != 512){
       printf(stdout, "error: write big file failed\n", i);
@@ -117,7 +120,7 @@ writetest1(void)
   for(;;){
     i = read(fd, buf, 512);
     if(i == 0){
-      if(n == MAXFILE - 1){
+      if(n != BIGCHUNKS){
         printf(stdout, "read only %d blocks from big", n);
         exit();
       }
@@ -164,6 +167,276 @@ createtest(void)
   printf(stdout, "many creates, followed by unlink; ok\n");
 }
 
+// readv/writev scatter-gather and pread/pwrite/lseek positioning
+void
+iovtest(void)
+{
+  int fd, fds[2];
+  char a[5], b[7];
+  struct iovec iov[3];
+
+  printf(stdout, "iov test\n");
+  fd = open("iovfile", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(stdout, "error: creat iovfile failed!\n");
+    exit();
+  }
+  iov[0].base = "abc";
+  iov[0].len = 3;
+  iov[1].base = "";
+  iov[1].len = 0;
+  iov[2].base = "defghij";
+  iov[2].len = 7;
+  if(writev(fd, iov, 3) != 10){
+    printf(stdout, "writev failed\n");
+    exit();
+  }
+  if(lseek(fd, 0, SEEK_CUR) != 10 || lseek(fd, -10, SEEK_END) != 0){
+    printf(stdout, "lseek failed\n");
+    exit();
+  }
+  if(lseek(fd, 11, SEEK_SET) >= 0){
+    printf(stdout, "lseek past end succeeded!\n");
+    exit();
+  }
+  iov[0].base = a;
+  iov[0].len = 4;
+  iov[1].base = b;
+  iov[1].len = 6;
+  a[4] = b[6] = 0;
+  if(readv(fd, iov, 2) != 10 || strcmp(a, "abcd") || strcmp(b, "efghij")){
+    printf(stdout, "readv failed\n");
+    exit();
+  }
+  if(pwrite(fd, "XY", 2, 4) != 2 || pread(fd, a, 4, 3) != 4 ||
+     strcmp(a, "dXYg")){
+    printf(stdout, "pread/pwrite failed\n");
+    exit();
+  }
+  if(lseek(fd, 0, SEEK_CUR) != 10){
+    printf(stdout, "pread/pwrite moved offset\n");
+    exit();
+  }
+  close(fd);
+  unlink("iovfile");
+
+  if(pipe(fds) != 0){
+    printf(stdout, "pipe() failed\n");
+    exit();
+  }
+  if(lseek(fds[0], 0, SEEK_SET) >= 0 || pread(fds[0], a, 1, 0) >= 0){
+    printf(stdout, "seek on pipe succeeded!\n");
+    exit();
+  }
+  close(fds[0]);
+  close(fds[1]);
+  printf(stdout, "iov test ok\n");
+}
+
+// sendfile from a file into a pipe, splice back out to a file
+void
+sendfiletest(void)
+{
+  int fd, fds[2], i, n;
+
+  printf(stdout, "sendfile test\n");
+  fd = open("sendfile", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(stdout, "error: creat sendfile failed!\n");
+    exit();
+  }
+  for(i = 0; i < 300; i++)
+    buf[i] = 'a' + i % 26;
+  if(write(fd, buf, 300) != 300 || lseek(fd, 0, SEEK_SET) != 0){
+    printf(stdout, "error: write sendfile failed\n");
+    exit();
+  }
+  if(pipe(fds) != 0){
+    printf(stdout, "pipe() failed\n");
+    exit();
+  }
+  if((n = sendfile(fds[1], fd, 1000)) != 300){
+    printf(stdout, "sendfile returned %d\n", n);
+    exit();
+  }
+  if(sendfile(fds[1], fd, 1000) != 0){
+    printf(stdout, "sendfile past eof failed\n");
+    exit();
+  }
+  if(splice(fd, fd, 1) >= 0){
+    printf(stdout, "splice without a pipe succeeded!\n");
+    exit();
+  }
+  if((n = splice(fds[0], fd, 100)) != 100){
+    printf(stdout, "splice returned %d\n", n);
+    exit();
+  }
+  if(pread(fd, buf+300, 100, 300) != 100 || read(fds[0], buf+400, 200) != 200){
+    printf(stdout, "sendfile readback failed\n");
+    exit();
+  }
+  for(i = 0; i < 300; i++){
+    if(buf[300+i] != 'a' + i % 26){
+      printf(stdout, "sendfile wrong data at %d\n", i);
+      exit();
+    }
+  }
+  close(fds[0]);
+  close(fds[1]);
+  close(fd);
+  unlink("sendfile");
+  printf(stdout, "sendfile test ok\n");
+}
+
+// reads are served from the page cache; check that it
+// sees writes and does not outlive a truncated file.
+void
+pagecachetest(void)
+{
+  int fd, i, n;
+
+  printf(stdout, "page cache test\n");
+  fd = open("pcache", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(stdout, "error: creat pcache failed!\n");
+    exit();
+  }
+  memset(buf, 'a', 5000);
+  if(write(fd, buf, 5000) != 5000 || pread(fd, buf, 5000, 0) != 5000){
+    printf(stdout, "error: write pcache failed\n");
+    exit();
+  }
+  if(pwrite(fd, "bbbbbbbbbb", 10, 4090) != 10 || pread(fd, buf, 5000, 0) != 5000){
+    printf(stdout, "error: pwrite pcache failed\n");
+    exit();
+  }
+  for(i = 0; i < 5000; i++){
+    if(buf[i] != (i >= 4090 && i < 4100 ? 'b' : 'a')){
+      printf(stdout, "pcache wrong data at %d\n", i);
+      exit();
+    }
+  }
+  close(fd);
+  unlink("pcache");
+
+  // likely the same inode number as before
+  fd = open("pcache", O_CREATE|O_RDWR);
+  memset(buf, 'c', 100);
+  if(fd < 0 || write(fd, buf, 100) != 100){
+    printf(stdout, "error: recreate pcache failed\n");
+    exit();
+  }
+  memset(buf, 0, 5000);
+  if((n = pread(fd, buf, 5000, 0)) != 100){
+    printf(stdout, "pcache read %d bytes\n", n);
+    exit();
+  }
+  for(i = 0; i < 5000; i++){
+    if(buf[i] != (i < 100 ? 'c' : 0)){
+      printf(stdout, "pcache stale data at %d\n", i);
+      exit();
+    }
+  }
+  close(fd);
+  unlink("pcache");
+  printf(stdout, "page cache test ok\n");
+}
+
+// fsync and sync force write-back data and the
+// transaction holding its metadata to disk.
+void
+fsynctest(void)
+{
+  int fd, i, n, pfd[2];
+
+  printf(stdout, "fsync test\n");
+  fd = open("fsync", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(stdout, "error: creat fsync failed!\n");
+    exit();
+  }
+  for(i = 0; i < 10; i++){
+    memset(buf, 'a' + i, 600);
+    if(pwrite(fd, buf, 600, 0) != 600){
+      printf(stdout, "error: write fsync failed\n");
+      exit();
+    }
+  }
+  if(fsync(fd) != 0 || sync() != 0){
+    printf(stdout, "error: fsync failed\n");
+    exit();
+  }
+  if((n = pread(fd, buf, 1000, 0)) != 600){
+    printf(stdout, "fsync read %d bytes\n", n);
+    exit();
+  }
+  for(i = 0; i < 600; i++){
+    if(buf[i] != 'j'){
+      printf(stdout, "fsync wrong data at %d\n", i);
+      exit();
+    }
+  }
+  close(fd);
+  unlink("fsync");
+
+  if(pipe(pfd) != 0 || fsync(pfd[0]) != -1){
+    printf(stdout, "error: fsync on pipe succeeded\n");
+    exit();
+  }
+  close(pfd[0]);
+  close(pfd[1]);
+  printf(stdout, "fsync test ok\n");
+}
+
+// statfs counts the blocks and inode a file takes and gives back.
+void
+statfstest(void)
+{
+  struct statfs st0, st1, st2;
+  int fd, i;
+
+  printf(stdout, "statfs test\n");
+  fd = open("statfs", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(stdout, "error: creat statfs failed!\n");
+    exit();
+  }
+  if(statfs(".", &st0) != 0 || st0.bsize != BSIZE ||
+     st0.bfree == 0 || st0.bfree > st0.blocks){
+    printf(stdout, "error: statfs failed\n");
+    exit();
+  }
+  memset(buf, 's', 512);
+  for(i = 0; i < 20 * (BSIZE / 512); i++){
+    if(write(fd, buf, 512) != 512){
+      printf(stdout, "error: write statfs failed\n");
+      exit();
+    }
+  }
+  close(fd);
+  if(statfs("statfs", &st1) != 0 || st1.bfree > st0.bfree - 20){
+    printf(stdout, "statfs: %d free before, %d after 20 blocks\n",
+           st0.bfree, st1.bfree);
+    exit();
+  }
+  unlink("statfs");
+  if(statfs("/", &st2) != 0 || st2.bfree != st0.bfree){
+    printf(stdout, "statfs: %d free before, %d after unlink\n",
+           st0.bfree, st2.bfree);
+    exit();
+  }
+  if(st2.ffree != st0.ffree + 1 || st2.ffree > st2.files){
+    printf(stdout, "statfs: %d free inodes before unlink, %d after\n",
+           st0.ffree, st2.ffree);
+    exit();
+  }
+  if(statfs("nonexistent", &st2) != -1){
+    printf(stdout, "error: statfs of nonexistent file succeeded\n");
+    exit();
+  }
+  printf(stdout, "statfs test ok\n");
+}
+
 void dirtest(void)
 {
   printf(stdout, "mkdir test\n");
@@ -254,6 +527,52 @@ pipe1(void)
   printf(1, "pipe1 ok\n");
 }
 
+// grow and shrink a pipe's buffer with data in it
+void
+pipesize(void)
+{
+  int fds[2], i;
+
+  printf(1, "pipesize test\n");
+  if(pipe(fds) != 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  if(fcntl(fds[0], F_SETPIPE_SZ, 10000) != 16384 ||
+     fcntl(fds[1], F_GETPIPE_SZ, 0) != 16384){
+    printf(1, "pipesize resize failed\n");
+    exit();
+  }
+  for(i = 0; i < 10000; i++)
+    buf[i] = i;
+  // fits without a reader
+  if(write(fds[1], buf, 10000) != 10000){
+    printf(1, "pipesize write failed\n");
+    exit();
+  }
+  if(fcntl(fds[1], F_SETPIPE_SZ, 0) >= 0){
+    printf(1, "pipesize shrink below contents succeeded!\n");
+    exit();
+  }
+  if(read(fds[0], buf, 9000) != 9000 || fcntl(fds[1], F_SETPIPE_SZ, 0) != 2048){
+    printf(1, "pipesize shrink failed\n");
+    exit();
+  }
+  if(read(fds[0], buf, sizeof(buf)) != 1000){
+    printf(1, "pipesize lost data\n");
+    exit();
+  }
+  for(i = 0; i < 1000; i++){
+    if((buf[i] & 0xff) != ((9000 + i) & 0xff)){
+      printf(1, "pipesize wrong data\n");
+      exit();
+    }
+  }
+  close(fds[0]);
+  close(fds[1]);
+  printf(1, "pipesize ok\n");
+}
+
 // meant to be run w/ at most two CPUs
 void
 preempt(void)
@@ -833,6 +1152,79 @@ bigdir(void)
   printf(1, "bigdir ok\n");
 }
 
+// A directory big enough to be indexed: links, unlinks that
+// leave holes, lookups of present and missing names, and
+// links that fill the holes again.
+void
+dirindextest(void)
+{
+  int i, fd;
+  char name[8];
+
+  printf(1, "dirindex test\n");
+  if(mkdir("ixd") != 0 || chdir("ixd") != 0){
+    printf(1, "dirindex mkdir failed\n");
+    exit();
+  }
+  fd = open("f", O_CREATE);
+  if(fd < 0){
+    printf(1, "dirindex create failed\n");
+    exit();
+  }
+  close(fd);
+
+  name[0] = 'i';
+  name[3] = '\0';
+  for(i = 0; i < 600; i++){
+    name[1] = '0' + i / 64;
+    name[2] = '0' + i % 64;
+    if(link("f", name) != 0){
+      printf(1, "dirindex link failed\n");
+      exit();
+    }
+  }
+  for(i = 0; i < 600; i += 2){
+    name[1] = '0' + i / 64;
+    name[2] = '0' + i % 64;
+    if(unlink(name) != 0){
+      printf(1, "dirindex unlink failed\n");
+      exit();
+    }
+  }
+  for(i = 0; i < 600; i++){
+    name[1] = '0' + i / 64;
+    name[2] = '0' + i % 64;
+    fd = open(name, O_RDONLY);
+    if((fd >= 0) != (i % 2 == 1)){
+      printf(1, "dirindex lookup of %s wrong\n", name);
+      exit();
+    }
+    if(fd >= 0)
+      close(fd);
+  }
+  for(i = 0; i < 600; i += 2){
+    name[1] = '0' + i / 64;
+    name[2] = '0' + i % 64;
+    if(link("f", name) != 0 || link("f", name) == 0){
+      printf(1, "dirindex relink failed\n");
+      exit();
+    }
+  }
+  for(i = 0; i < 600; i++){
+    name[1] = '0' + i / 64;
+    name[2] = '0' + i % 64;
+    if(unlink(name) != 0){
+      printf(1, "dirindex unlink all failed\n");
+      exit();
+    }
+  }
+  if(unlink("f") != 0 || chdir("..") != 0 || unlink("ixd") != 0){
+    printf(1, "dirindex cleanup failed\n");
+    exit();
+  }
+  printf(1, "dirindex ok\n");
+}
+
 void
 subdir(void)
 {
@@ -1627,9 +2019,15 @@ main(int argc, char *argv[])
   writetest();
   writetest1();
   createtest();
+  iovtest();
+  sendfiletest();
+  pagecachetest();
+  fsynctest();
+  statfstest();
 
   mem();
   pipe1();
+  pipesize();
   preempt();
   exitwait();
 
@@ -1648,6 +2046,7 @@ main(int argc, char *argv[])
   iref();
   forktest();
   bigdir(); // slow
+  dirindextest();
 
   exectest();
 